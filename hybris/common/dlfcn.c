@@ -18,9 +18,15 @@
 #include <../include/hybris/dlfcn/dlfcn.h>
 #include <../include/hybris/internal/binding.h>
 
+#include "metrics.h"
+
 void *hybris_dlopen(const char *filename, int flag)
 {
-    return android_dlopen(filename,flag);
+    uint64_t start = HYBRIS_METRIC_START_US();
+    void *handle = android_dlopen(filename,flag);
+
+    HYBRIS_METRIC_RECORD("linker.dlopen_us", hybris_metric_now_us() - start);
+    return handle;
 }
 
 
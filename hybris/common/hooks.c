@@ -17,11 +17,9 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <hybris/internal/floating_point_abi.h>
 
-#include "hooks_shm.h"
-
-#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdio_ext.h>
@@ -54,6 +52,13 @@
 
 #include <hybris/properties/properties.h>
 
+#include "hooks_shm.h"
+#include "hooks_alloc.h"
+#include "hooks_heap.h"
+#include "hooks_stats.h"
+#include "hooks_sched.h"
+#include "hooks_lockprof.h"
+
 static locale_t hybris_locale;
 static int locale_inited = 0;
 /* TODO:
@@ -223,9 +228,161 @@ static pthread_rwlock_t* hybris_alloc_init_rwlock(void)
  *
  * */
 
+/*
+ * All allocations made by Android code go through these, so that the
+ * allocator backend and the optional per-library accounting apply.
+ */
+
+static void *_android_malloc(size_t size, const void *caller)
+{
+    if (hybris_heap_enabled)
+        return hybris_heap_malloc(size, caller);
+
+    return hybris_alloc.malloc(size);
+}
+
+static void *_android_realloc(void *ptr, size_t size, const void *caller)
+{
+    if (hybris_heap_enabled)
+        return hybris_heap_realloc(ptr, size, caller);
+
+    return hybris_alloc.realloc(ptr, size);
+}
+
+static void *_android_memalign(size_t alignment, size_t size, const void *caller)
+{
+    if (hybris_heap_enabled)
+        return hybris_heap_memalign(alignment, size, caller);
+
+    return hybris_alloc.memalign(alignment, size);
+}
+
+/* Whether memory freed by Android code can come straight from glibc */
+static int _android_alloc_is_glibc(void)
+{
+    return !hybris_alloc_is_foreign() && !hybris_heap_enabled;
+}
+
 static void *my_malloc(size_t size)
 {
-    return malloc(size);
+    return _android_malloc(size, __builtin_return_address(0));
+}
+
+static void my_free(void *ptr)
+{
+    if (hybris_heap_enabled)
+        hybris_heap_free(ptr);
+    else
+        hybris_alloc.free(ptr);
+}
+
+static void *my_calloc(size_t nmemb, size_t size)
+{
+    if (hybris_heap_enabled)
+        return hybris_heap_calloc(nmemb, size, __builtin_return_address(0));
+
+    return hybris_alloc.calloc(nmemb, size);
+}
+
+static void *my_realloc(void *ptr, size_t size)
+{
+    return _android_realloc(ptr, size, __builtin_return_address(0));
+}
+
+static void *my_memalign(size_t alignment, size_t size)
+{
+    return _android_memalign(alignment, size, __builtin_return_address(0));
+}
+
+static void *my_valloc(size_t size)
+{
+    return _android_memalign(getpagesize(), size, __builtin_return_address(0));
+}
+
+static void *my_pvalloc(size_t size)
+{
+    size_t pagesize = getpagesize();
+
+    return _android_memalign(pagesize, (size + pagesize - 1) & ~(pagesize - 1),
+                             __builtin_return_address(0));
+}
+
+/*
+ * Memory returned to Android code that it is expected to free() itself has
+ * to come from the same allocator as the malloc hooks above.
+ */
+
+static char *my_strdup(const char *s)
+{
+    size_t len;
+    char *ret;
+
+    if (_android_alloc_is_glibc())
+        return strdup(s);
+
+    len = strlen(s) + 1;
+    ret = _android_malloc(len, __builtin_return_address(0));
+    if (ret != NULL)
+        memcpy(ret, s, len);
+    return ret;
+}
+
+static char *my_strndup(const char *s, size_t n)
+{
+    size_t len;
+    char *ret;
+
+    if (_android_alloc_is_glibc())
+        return strndup(s, n);
+
+    len = strnlen(s, n);
+    ret = _android_malloc(len + 1, __builtin_return_address(0));
+    if (ret != NULL) {
+        memcpy(ret, s, len);
+        ret[len] = '\0';
+    }
+    return ret;
+}
+
+static int _android_vasprintf(char **strp, const char *fmt, va_list ap, const void *caller)
+{
+    va_list aq;
+    char *ret;
+    int len;
+
+    if (_android_alloc_is_glibc())
+        return vasprintf(strp, fmt, ap);
+
+    va_copy(aq, ap);
+    len = vsnprintf(NULL, 0, fmt, aq);
+    va_end(aq);
+    if (len < 0)
+        return -1;
+
+    ret = _android_malloc(len + 1, caller);
+    if (ret == NULL)
+        return -1;
+
+    vsnprintf(ret, len + 1, fmt, ap);
+    *strp = ret;
+    return len;
+}
+
+static int my_vasprintf(char **strp, const char *fmt, va_list ap)
+{
+    return _android_vasprintf(strp, fmt, ap, __builtin_return_address(0));
+}
+
+static int my_asprintf(char **strp, const char *fmt, ...)
+{
+    va_list ap;
+    int ret;
+
+    va_start(ap, fmt);
+    ret = _android_vasprintf(strp, fmt, ap, __builtin_return_address(0));
+    va_end(ap);
+
+    return ret;
 }
 
 static void *my_memcpy(void *dst, const void *src, size_t len)
@@ -261,9 +418,22 @@ static int my_pthread_create(pthread_t *thread, const pthread_attr_t *__attr,
     if (__attr != NULL)
         realattr = (pthread_attr_t *) *(unsigned int *) __attr;
 
+    if (hybris_thread_policy_enabled)
+        return hybris_thread_policy_create(thread, realattr, start_routine, arg);
+
     return pthread_create(thread, realattr, start_routine, arg);
 }
 
+static int my_pthread_setname_np(pthread_t thread, const char *name)
+{
+    int ret = pthread_setname_np(thread, name);
+
+    if (ret == 0 && hybris_thread_policy_enabled)
+        hybris_thread_policy_setname(thread, name);
+
+    return ret;
+}
+
 /*
  * pthread_attr_* functions
  *
@@ -491,7 +661,15 @@ static int my_pthread_mutex_lock(pthread_mutex_t *__mutex)
         *((unsigned int *)__mutex) = (unsigned int) realmutex;
     }
 
-    return pthread_mutex_lock(realmutex);
+    HOOK_STATS_BEGIN(HOOK_STAT_MUTEX_LOCK);
+    int ret;
+    if (hybris_lockprof_enabled)
+        ret = hybris_lockprof_mutex_lock(realmutex, __mutex, __builtin_return_address(0));
+    else
+        ret = pthread_mutex_lock(realmutex);
+    HOOK_STATS_END(0);
+
+    return ret;
 }
 
 static int my_pthread_mutex_trylock(pthread_mutex_t *__mutex)
@@ -708,7 +886,11 @@ static int my_pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
         *((unsigned int *) mutex) = (unsigned int) realmutex;
     }
 
-    return pthread_cond_wait(realcond, realmutex);
+    HOOK_STATS_BEGIN(HOOK_STAT_COND_WAIT);
+    int ret = pthread_cond_wait(realcond, realmutex);
+    HOOK_STATS_END(0);
+
+    return ret;
 }
 
 static int my_pthread_cond_timedwait(pthread_cond_t *cond,
@@ -742,7 +924,11 @@ static int my_pthread_cond_timedwait(pthread_cond_t *cond,
         *((unsigned int *) mutex) = (unsigned int) realmutex;
     }
 
-    return pthread_cond_timedwait(realcond, realmutex, abstime);
+    HOOK_STATS_BEGIN(HOOK_STAT_COND_TIMEDWAIT);
+    int ret = pthread_cond_timedwait(realcond, realmutex, abstime);
+    HOOK_STATS_END(0);
+
+    return ret;
 }
 
 static int my_pthread_cond_timedwait_relative_np(pthread_cond_t *cond,
@@ -905,7 +1091,16 @@ static pthread_rwlock_t* hybris_set_realrwlock(pthread_rwlock_t *rwlock)
 static int my_pthread_rwlock_rdlock(pthread_rwlock_t *__rwlock)
 {
     pthread_rwlock_t *realrwlock = hybris_set_realrwlock(__rwlock);
-    return pthread_rwlock_rdlock(realrwlock);
+
+    HOOK_STATS_BEGIN(HOOK_STAT_RWLOCK_RDLOCK);
+    int ret;
+    if (hybris_lockprof_enabled)
+        ret = hybris_lockprof_rwlock_rdlock(realrwlock, __rwlock, __builtin_return_address(0));
+    else
+        ret = pthread_rwlock_rdlock(realrwlock);
+    HOOK_STATS_END(0);
+
+    return ret;
 }
 
 static int my_pthread_rwlock_tryrdlock(pthread_rwlock_t *__rwlock)
@@ -924,7 +1119,16 @@ static int my_pthread_rwlock_timedrdlock(pthread_rwlock_t *__rwlock,
 static int my_pthread_rwlock_wrlock(pthread_rwlock_t *__rwlock)
 {
     pthread_rwlock_t *realrwlock = hybris_set_realrwlock(__rwlock);
-    return pthread_rwlock_wrlock(realrwlock);
+
+    HOOK_STATS_BEGIN(HOOK_STAT_RWLOCK_WRLOCK);
+    int ret;
+    if (hybris_lockprof_enabled)
+        ret = hybris_lockprof_rwlock_wrlock(realrwlock, __rwlock, __builtin_return_address(0));
+    else
+        ret = pthread_rwlock_wrlock(realrwlock);
+    HOOK_STATS_END(0);
+
+    return ret;
 }
 
 static int my_pthread_rwlock_trywrlock(pthread_rwlock_t *__rwlock)
@@ -1006,6 +1210,15 @@ static void my_clearerr(FILE *fp)
     clearerr(_get_actual_fp(fp));
 }
 
+static FILE *my_fopen(const char *path, const char *mode)
+{
+    HOOK_STATS_BEGIN(HOOK_STAT_FOPEN);
+    FILE *ret = fopen(path, mode);
+    HOOK_STATS_END(0);
+
+    return ret;
+}
+
 static int my_fclose(FILE *fp)
 {
     return fclose(_get_actual_fp(fp));
@@ -1038,7 +1251,11 @@ static int my_fgetpos(FILE *fp, fpos_t *pos)
 
 static char* my_fgets(char *s, int n, FILE *fp)
 {
-    return fgets(s, n, _get_actual_fp(fp));
+    HOOK_STATS_BEGIN(HOOK_STAT_FGETS);
+    char *ret = fgets(s, n, _get_actual_fp(fp));
+    HOOK_STATS_END(ret ? strlen(ret) : 0);
+
+    return ret;
 }
 
 FP_ATTRIB static int my_fprintf(FILE *fp, const char *fmt, ...)
@@ -1065,7 +1282,11 @@ static int my_fputs(const char *s, FILE *fp)
 
 static size_t my_fread(void *ptr, size_t size, size_t nmemb, FILE *fp)
 {
-    return fread(ptr, size, nmemb, _get_actual_fp(fp));
+    HOOK_STATS_BEGIN(HOOK_STAT_FREAD);
+    size_t ret = fread(ptr, size, nmemb, _get_actual_fp(fp));
+    HOOK_STATS_END(ret * size);
+
+    return ret;
 }
 
 static FILE* my_freopen(const char *filename, const char *mode, FILE *fp)
@@ -1112,7 +1333,11 @@ static off_t my_ftello(FILE *fp)
 
 static size_t my_fwrite(const void *ptr, size_t size, size_t nmemb, FILE *fp)
 {
-    return fwrite(ptr, size, nmemb, _get_actual_fp(fp));
+    HOOK_STATS_BEGIN(HOOK_STAT_FWRITE);
+    size_t ret = fwrite(ptr, size, nmemb, _get_actual_fp(fp));
+    HOOK_STATS_END(ret * size);
+
+    return ret;
 }
 
 static int my_getc(FILE *fp)
@@ -1120,14 +1345,59 @@ static int my_getc(FILE *fp)
     return getc(_get_actual_fp(fp));
 }
 
+static ssize_t _android_getdelim(char **lineptr, size_t *n, int delimiter, FILE *fp,
+                                 const void *caller)
+{
+    size_t len = 0;
+    int c;
+
+    if (_android_alloc_is_glibc())
+        return getdelim(lineptr, n, delimiter, _get_actual_fp(fp));
+
+    /* glibc would grow *lineptr with its own realloc, do it ourselves */
+    if (lineptr == NULL || n == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    fp = _get_actual_fp(fp);
+
+    flockfile(fp);
+    for (;;) {
+        if (*lineptr == NULL || len + 2 > *n) {
+            size_t size = *lineptr == NULL || *n < 120 ? 120 : *n * 2;
+            char *line = _android_realloc(*lineptr, size, caller);
+            if (line == NULL) {
+                funlockfile(fp);
+                errno = ENOMEM;
+                return -1;
+            }
+            *lineptr = line;
+            *n = size;
+        }
+
+        c = getc_unlocked(fp);
+        if (c == EOF)
+            break;
+
+        (*lineptr)[len++] = c;
+        if (c == delimiter)
+            break;
+    }
+    funlockfile(fp);
+
+    (*lineptr)[len] = '\0';
+    return len ? (ssize_t) len : -1;
+}
+
 static ssize_t my_getdelim(char ** lineptr, size_t *n, int delimiter, FILE * fp)
 {
-    return getdelim(lineptr, n, delimiter, _get_actual_fp(fp));
+    return _android_getdelim(lineptr, n, delimiter, fp, __builtin_return_address(0));
 }
 
 static ssize_t my_getline(char **lineptr, size_t *n, FILE *fp)
 {
-    return getline(lineptr, n, _get_actual_fp(fp));
+    return _android_getdelim(lineptr, n, '\n', fp, __builtin_return_address(0));
 }
 
 
@@ -1281,34 +1551,87 @@ FP_ATTRIB static double my_strtod(const char *nptr, char **endptr)
 	return strtod_l(nptr, endptr, hybris_locale);
 }
 
+/*
+ * Values come from the area while it is in sync with the property service,
+ * without any system call, and from the service otherwise.
+ */
 static int __my_system_property_read(const void *pi, char *name, char *value)
 {
-    return property_get(name, value, NULL);
+    char key[PROP_NAME_MAX], live[PROP_VALUE_MAX];
+    int ret;
+
+    if (pi == NULL)
+        return 0;
+
+    ret = property_read(pi, key, value);
+    if (name)
+        memcpy(name, key, PROP_NAME_MAX);
+
+    if (value && !property_area_synced() && property_get(key, live, NULL) > 0) {
+        strcpy(value, live);
+        ret = strlen(live);
+    }
+
+    return ret;
 }
 
 static int __my_system_property_get(const char *name, char *value)
 {
-    return property_get(name, value, NULL);
+    const prop_info *pi;
+
+    if (!property_area_synced())
+        return property_get(name, value, NULL);
+
+    /* the area holds every property set as of the last refresh */
+    pi = property_find(name);
+    if (pi != NULL)
+        return property_read(pi, NULL, value);
+
+    value[0] = '\0';
+    return 0;
 }
 
 static int __my_system_property_foreach(void (*propfn)(const void *pi, void *cookie), void *cookie)
 {
-    return 0;
+    return property_foreach((void (*)(const prop_info *, void *)) propfn, cookie);
 }
 
 static const void *__my_system_property_find(const char *name)
 {
-    return NULL;
+    return property_find(name);
 }
 
 static unsigned int __my_system_property_serial(const void *pi)
 {
-    return 0;
+    return property_serial(pi);
 }
 
+/*
+ * Changes made by init only move the area serials once the area is
+ * refreshed, so the waits below wake up every PROPERTY_WAIT_POLL_MS to
+ * look again.
+ */
 static int __my_system_property_wait(const void *pi)
 {
-    return 0;
+    char name[PROP_NAME_MAX], old_value[PROP_VALUE_MAX], value[PROP_VALUE_MAX];
+    unsigned int serial;
+
+    if (pi == NULL) {
+        serial = property_area_serial();
+        property_wait_serial(NULL, serial, PROPERTY_WAIT_POLL_MS);
+        return 0;
+    }
+
+    __my_system_property_read(pi, name, old_value);
+
+    for (;;) {
+        serial = property_serial(pi);
+        if (property_wait_serial(pi, serial, PROPERTY_WAIT_POLL_MS) != serial)
+            return 0;
+
+        if (__my_system_property_get(name, value) >= 0 && strcmp(value, old_value) != 0)
+            return 0;
+    }
 }
 
 static int __my_system_property_update(void *pi, const char *value, unsigned int len)
@@ -1321,14 +1644,15 @@ static int __my_system_property_add(const char *name, unsigned int namelen, cons
     return 0;
 }
 
+/* Returns after at most PROPERTY_WAIT_POLL_MS, callers look again */
 static unsigned int __my_system_property_wait_any(unsigned int serial)
 {
-    return 0;
+    return property_wait_serial(NULL, serial, PROPERTY_WAIT_POLL_MS);
 }
 
 static const void *__my_system_property_find_nth(unsigned n)
 {
-    return NULL;
+    return property_find_nth(n);
 }
 
 extern int __cxa_atexit(void (*)(void*), void*, void*);
@@ -1339,14 +1663,13 @@ static struct _hook hooks[] = {
     {"getenv", getenv },
     {"printf", printf },
     {"malloc", my_malloc },
-    {"free", free },
-    {"calloc", calloc },
-    {"cfree", cfree },
-    {"realloc", realloc },
-    {"memalign", memalign },
-    {"valloc", valloc },
-    {"pvalloc", pvalloc },
-    {"fread", fread },
+    {"free", my_free },
+    {"calloc", my_calloc },
+    {"cfree", my_free },
+    {"realloc", my_realloc },
+    {"memalign", my_memalign },
+    {"valloc", my_valloc },
+    {"pvalloc", my_pvalloc },
     {"getxattr", getxattr},
     /* string.h */
     {"memccpy",memccpy},
@@ -1368,7 +1691,7 @@ static struct _hook hooks[] = {
     {"strcat",strcat},
     {"strcasecmp",strcasecmp},
     {"strncasecmp",strncasecmp},
-    {"strdup",strdup},
+    {"strdup",my_strdup},
     {"strstr",strstr},
     {"strtok",strtok},
     {"strtok_r",strtok_r},
@@ -1376,7 +1699,7 @@ static struct _hook hooks[] = {
     {"strerror_r",strerror_r},
     {"strnlen",strnlen},
     {"strncat",strncat},
-    {"strndup",strndup},
+    {"strndup",my_strndup},
     {"strncmp",strncmp},
     {"strncpy",strncpy},
     {"strtod", my_strtod},
@@ -1439,7 +1762,7 @@ static struct _hook hooks[] = {
     {"pthread_cond_timedwait_monotonic_np", my_pthread_cond_timedwait},
     {"pthread_cond_timedwait_relative_np", my_pthread_cond_timedwait_relative_np},
     {"pthread_key_delete", pthread_key_delete},
-    {"pthread_setname_np", pthread_setname_np},
+    {"pthread_setname_np", my_pthread_setname_np},
     {"pthread_once", pthread_once},
     {"pthread_key_create", pthread_key_create},
     {"pthread_setspecific", pthread_setspecific},
@@ -1479,13 +1802,13 @@ static struct _hook hooks[] = {
     /* stdio.h */
     {"__isthreaded", &__my_isthreaded},
     {"__sF", &my_sF},
-    {"fopen", fopen},
+    {"fopen", my_fopen},
     {"fdopen", fdopen},
     {"popen", popen},
     {"puts", puts},
     {"sprintf", sprintf},
-    {"asprintf", asprintf},
-    {"vasprintf", vasprintf},
+    {"asprintf", my_asprintf},
+    {"vasprintf", my_vasprintf},
     {"snprintf", snprintf},
     {"vsprintf", vsprintf},
     {"vsnprintf", vsnprintf},
@@ -1517,7 +1840,7 @@ static struct _hook hooks[] = {
     {"setbuf", my_setbuf},
     {"setvbuf", my_setvbuf},
     {"ungetc", my_ungetc},
-    {"vasprintf", vasprintf},
+    {"vasprintf", my_vasprintf},
     {"vfprintf", my_vfprintf},
     {"vfscanf", my_vfscanf},
     {"fileno", my_fileno},
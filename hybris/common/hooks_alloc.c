@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "hooks_alloc.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <malloc.h>
+#include <errno.h>
+#include <dlfcn.h>
+
+/* Debug */
+#include "logging.h"
+#define LOGD(message, ...) HYBRIS_DEBUG_LOG(HOOKS, message, ##__VA_ARGS__)
+
+/* The default backend is the host's glibc allocator */
+struct hybris_alloc_backend hybris_alloc = {
+    "glibc",
+    malloc,
+    free,
+    calloc,
+    realloc,
+    memalign,
+};
+
+static int (*_backend_posix_memalign)(void **memptr, size_t alignment, size_t size) = NULL;
+
+static void *_posix_memalign_wrapper(size_t alignment, size_t size)
+{
+    void *ptr = NULL;
+
+    if (_backend_posix_memalign(&ptr, alignment, size) != 0)
+        return NULL;
+
+    return ptr;
+}
+
+/*
+ * Look up "prefix" + "name" in the backend library
+ */
+static void *_backend_sym(void *handle, const char *prefix, const char *name)
+{
+    char symbol[64];
+
+    snprintf(symbol, sizeof(symbol), "%s%s", prefix, name);
+    return dlsym(handle, symbol);
+}
+
+/*
+ * Load the allocator named by HYBRIS_MALLOC_LIBRARY. This runs when
+ * libhybris-common is loaded, that is before any Android library had a
+ * chance to allocate memory through the hooks, so switching the backend
+ * can never mix up pointers between two allocators.
+ */
+static void __attribute__((constructor)) _hybris_alloc_init(void)
+{
+    const char *library = getenv("HYBRIS_MALLOC_LIBRARY");
+    const char *prefix = getenv("HYBRIS_MALLOC_PREFIX");
+    struct hybris_alloc_backend backend;
+    void *handle;
+
+    if (library == NULL || *library == '\0')
+        return;
+
+    if (prefix == NULL)
+        prefix = "";
+
+    /* RTLD_LOCAL: the allocator must not interpose the host's malloc */
+    handle = dlopen(library, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        fprintf(stderr, "libhybris: can't load allocator %s (%s), using glibc\n",
+                library, dlerror());
+        return;
+    }
+
+    backend.name = library;
+    backend.malloc = _backend_sym(handle, prefix, "malloc");
+    backend.free = _backend_sym(handle, prefix, "free");
+    backend.calloc = _backend_sym(handle, prefix, "calloc");
+    backend.realloc = _backend_sym(handle, prefix, "realloc");
+    backend.memalign = _backend_sym(handle, prefix, "memalign");
+
+    if (backend.memalign == NULL) {
+        _backend_posix_memalign = _backend_sym(handle, prefix, "posix_memalign");
+        if (_backend_posix_memalign != NULL)
+            backend.memalign = _posix_memalign_wrapper;
+    }
+
+    if (backend.malloc == NULL || backend.free == NULL ||
+        backend.calloc == NULL || backend.realloc == NULL ||
+        backend.memalign == NULL) {
+        fprintf(stderr, "libhybris: %s does not export the malloc family%s%s, using glibc\n",
+                library, *prefix ? " with prefix " : "", prefix);
+        dlclose(handle);
+        return;
+    }
+
+    LOGD("Using %s for allocations made by Android code", library);
+    hybris_alloc = backend;
+}
+
+int hybris_alloc_is_foreign(void)
+{
+    return hybris_alloc.malloc != malloc;
+}
+
+// vim:ts=4:sw=4:noexpandtab
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef HOOKS_ALLOC_H_
+#define HOOKS_ALLOC_H_
+
+#include <stddef.h>
+
+/*
+ * Allocator used for all malloc-family calls made by Android code.
+ *
+ * By default this is glibc. Setting HYBRIS_MALLOC_LIBRARY to the path of a
+ * shared object exporting malloc, free, calloc, realloc and memalign (or
+ * posix_memalign) makes hybris load it privately (RTLD_LOCAL) and route the
+ * hooked allocations through it, without affecting the host process.
+ * HYBRIS_MALLOC_PREFIX can be used for allocators exporting prefixed names,
+ * e.g. "je_" for a jemalloc built with a symbol prefix.
+ */
+struct hybris_alloc_backend {
+    const char *name;
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*calloc)(size_t nmemb, size_t size);
+    void *(*realloc)(void *ptr, size_t size);
+    void *(*memalign)(size_t alignment, size_t size);
+};
+
+extern struct hybris_alloc_backend hybris_alloc;
+
+/*
+ * Returns nonzero if hooked allocations do not go to glibc, in which case
+ * memory handed out to Android code by other hooks (strdup, getline, ...)
+ * must be allocated through hybris_alloc as well.
+ */
+int hybris_alloc_is_foreign(void);
+
+#endif
+
+// vim:ts=4:sw=4:noexpandtab
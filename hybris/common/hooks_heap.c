@@ -0,0 +1,416 @@
+/*
+ * Copyright (C) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "hooks_heap.h"
+#include "hooks_alloc.h"
+#include "hooks_libmap.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* Debug */
+#include "logging.h"
+#define LOGD(message, ...) HYBRIS_DEBUG_LOG(HOOKS, message, ##__VA_ARGS__)
+
+#define HEAP_HEADER_SIZE 32
+#define HEAP_HEADER_SHIFT 5
+
+/* What the backend's malloc() aligns to, as glibc's MALLOC_ALIGNMENT */
+#define HEAP_MALLOC_ALIGNMENT (2 * sizeof(size_t))
+
+/* XORed with the pointer handed out; sets bits no chunk size ever has */
+#define HEAP_MAGIC ((uintptr_t) 0x5eed1e55a110c8edULL)
+
+/* How far a thread's count of live bytes may drift before it is merged */
+#define HEAP_FLUSH_BYTES (64 * 1024)
+
+/*
+ * Stored right in front of every pointer handed out. align_shift is the
+ * log2 of the distance to the start of the underlying allocation.
+ *
+ * free() and realloc() also see memory the host allocated (e.g.
+ * getcwd(NULL, 0)), which has no header. magic is last, in the word right
+ * in front of the pointer, where the host's allocator keeps the size of the
+ * chunk: that word is always readable, and the rest of the header is only
+ * read once magic matches.
+ */
+struct heap_header {
+    size_t size;
+    unsigned short slot;
+    unsigned char align_shift;
+    uintptr_t magic;
+};
+
+/*
+ * Counters only ever written by their owning thread, the report sums them
+ * up. Tables of exited threads are recycled rather than freed, so the
+ * totals stay correct. pending is the change in live bytes not merged into
+ * _live yet; blocks freed by another thread than the one that allocated
+ * them make it go negative.
+ */
+struct heap_thread_stats {
+    struct heap_thread_stats *next;
+    int retired;
+    unsigned long allocs[HYBRIS_LIBMAP_MAX];
+    unsigned long frees[HYBRIS_LIBMAP_MAX];
+    unsigned long long bytes[HYBRIS_LIBMAP_MAX];
+    long pending[HYBRIS_LIBMAP_MAX];
+};
+
+int hybris_heap_enabled = 0;
+
+/* Only touched once a thread's pending bytes grow past HEAP_FLUSH_BYTES,
+ * so peaks are exact to that much per thread */
+static long _live[HYBRIS_LIBMAP_MAX];
+static long _peak[HYBRIS_LIBMAP_MAX];
+
+static struct heap_thread_stats *_threads = NULL;
+static pthread_mutex_t _threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t _threads_key;
+
+static __thread struct heap_thread_stats *_stats;
+static __thread int _stats_exiting;
+
+static unsigned long _last_allocs[HYBRIS_LIBMAP_MAX];
+static struct timespec _last_report;
+
+static void _update_peak(int slot, long live)
+{
+    long peak = _peak[slot];
+
+    while (live > peak && !__sync_bool_compare_and_swap(&_peak[slot], peak, live))
+        peak = _peak[slot];
+}
+
+static void _flush_pending(struct heap_thread_stats *stats, int slot)
+{
+    long live = __sync_add_and_fetch(&_live[slot], stats->pending[slot]);
+
+    if (stats->pending[slot] > 0)
+        _update_peak(slot, live);
+    stats->pending[slot] = 0;
+}
+
+static void _thread_stats_retire(void *data)
+{
+    struct heap_thread_stats *stats = data;
+    int slot;
+
+    pthread_mutex_lock(&_threads_mutex);
+    for (slot = 0; slot < HYBRIS_LIBMAP_MAX; slot++) {
+        if (stats->pending[slot] != 0)
+            _flush_pending(stats, slot);
+    }
+    stats->retired = 1;
+    pthread_mutex_unlock(&_threads_mutex);
+
+    _stats = NULL;
+    _stats_exiting = 1;
+}
+
+static struct heap_thread_stats *_thread_stats(void)
+{
+    struct heap_thread_stats *stats;
+
+    if (_stats != NULL || _stats_exiting)
+        return _stats;
+
+    pthread_mutex_lock(&_threads_mutex);
+    for (stats = _threads; stats != NULL; stats = stats->next) {
+        if (stats->retired) {
+            stats->retired = 0;
+            break;
+        }
+    }
+    if (stats == NULL) {
+        stats = calloc(1, sizeof(*stats));
+        if (stats != NULL) {
+            stats->next = _threads;
+            _threads = stats;
+        }
+    }
+    pthread_mutex_unlock(&_threads_mutex);
+
+    if (stats != NULL)
+        pthread_setspecific(_threads_key, stats);
+
+    _stats = stats;
+    return stats;
+}
+
+static void _account_alloc(int slot, size_t size)
+{
+    struct heap_thread_stats *stats = _thread_stats();
+
+    if (stats == NULL) {
+        /* threads on their way out go straight to the totals */
+        _update_peak(slot, __sync_add_and_fetch(&_live[slot], (long) size));
+        return;
+    }
+
+    stats->allocs[slot]++;
+    stats->bytes[slot] += size;
+    stats->pending[slot] += size;
+    if (stats->pending[slot] > HEAP_FLUSH_BYTES)
+        _flush_pending(stats, slot);
+}
+
+static void _account_free(int slot, size_t size)
+{
+    struct heap_thread_stats *stats = _thread_stats();
+
+    if (stats == NULL) {
+        __sync_sub_and_fetch(&_live[slot], (long) size);
+        return;
+    }
+
+    stats->frees[slot]++;
+    stats->pending[slot] -= size;
+    if (stats->pending[slot] < -HEAP_FLUSH_BYTES)
+        _flush_pending(stats, slot);
+}
+
+/* The header of ptr, NULL if the host allocated it */
+static struct heap_header *_heap_header(void *ptr)
+{
+    struct heap_header *header = (struct heap_header *) ((char *) ptr - sizeof(*header));
+
+    if (header->magic != ((uintptr_t) ptr ^ HEAP_MAGIC))
+        return NULL;
+
+    return header;
+}
+
+static void *_heap_finish(char *base, unsigned int shift, size_t size, const void *caller)
+{
+    struct heap_header *header;
+    char *ptr;
+
+    if (base == NULL)
+        return NULL;
+
+    ptr = base + (1UL << shift);
+    header = (struct heap_header *) (ptr - sizeof(*header));
+    header->size = size;
+    header->slot = hybris_libmap_slot(caller);
+    header->align_shift = shift;
+    header->magic = (uintptr_t) ptr ^ HEAP_MAGIC;
+
+    _account_alloc(header->slot, size);
+
+    return ptr;
+}
+
+static void _heap_release(struct heap_header *header, void *ptr)
+{
+    _account_free(header->slot, header->size);
+    /* a stale pointer freed again must not look like ours */
+    header->magic = 0;
+    hybris_alloc.free((char *) ptr - (1UL << header->align_shift));
+}
+
+void *hybris_heap_malloc(size_t size, const void *caller)
+{
+    if (size > (size_t) -1 - HEAP_HEADER_SIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return _heap_finish(hybris_alloc.malloc(size + HEAP_HEADER_SIZE),
+                        HEAP_HEADER_SHIFT, size, caller);
+}
+
+void *hybris_heap_calloc(size_t nmemb, size_t size, const void *caller)
+{
+    void *ptr;
+
+    if (size != 0 && nmemb > ((size_t) -1 - HEAP_HEADER_SIZE) / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ptr = hybris_heap_malloc(nmemb * size, caller);
+    if (ptr != NULL)
+        memset(ptr, 0, nmemb * size);
+
+    return ptr;
+}
+
+void *hybris_heap_memalign(size_t alignment, size_t size, const void *caller)
+{
+    unsigned int shift;
+
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    /* the header keeps the backend's alignment, but nothing more */
+    if (alignment <= HEAP_MALLOC_ALIGNMENT)
+        return hybris_heap_malloc(size, caller);
+
+    shift = __builtin_ctzl(alignment);
+    if (shift < HEAP_HEADER_SHIFT)
+        shift = HEAP_HEADER_SHIFT;
+
+    if (size > (size_t) -1 - (1UL << shift)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return _heap_finish(hybris_alloc.memalign(1UL << shift, size + (1UL << shift)),
+                        shift, size, caller);
+}
+
+void hybris_heap_free(void *ptr)
+{
+    struct heap_header *header;
+
+    if (ptr == NULL)
+        return;
+
+    header = _heap_header(ptr);
+    if (header == NULL) {
+        hybris_alloc.free(ptr);
+        return;
+    }
+
+    _heap_release(header, ptr);
+}
+
+void *hybris_heap_realloc(void *ptr, size_t size, const void *caller)
+{
+    struct heap_header *header;
+    size_t old_size;
+    int old_slot;
+    char *base;
+    void *ret;
+
+    if (ptr == NULL)
+        return hybris_heap_malloc(size, caller);
+
+    if (size == 0) {
+        hybris_heap_free(ptr);
+        return NULL;
+    }
+
+    header = _heap_header(ptr);
+    if (header == NULL)
+        return hybris_alloc.realloc(ptr, size);
+
+    if (header->align_shift != HEAP_HEADER_SHIFT) {
+        /* Keep memaligned blocks simple: move them to a plain block */
+        ret = hybris_heap_malloc(size, caller);
+        if (ret == NULL)
+            return NULL;
+        memcpy(ret, ptr, header->size < size ? header->size : size);
+        _heap_release(header, ptr);
+        return ret;
+    }
+
+    old_size = header->size;
+    old_slot = header->slot;
+
+    if (size > (size_t) -1 - HEAP_HEADER_SIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    /* the old block may stay where it is or move, either way it is gone */
+    header->magic = 0;
+    base = hybris_alloc.realloc((char *) ptr - HEAP_HEADER_SIZE, size + HEAP_HEADER_SIZE);
+    if (base == NULL) {
+        header->magic = (uintptr_t) ptr ^ HEAP_MAGIC;
+        return NULL;
+    }
+
+    /* The block now belongs to whoever resized it */
+    _account_free(old_slot, old_size);
+    return _heap_finish(base, HEAP_HEADER_SHIFT, size, caller);
+}
+
+static void _heap_report(FILE *out)
+{
+    struct heap_thread_stats *stats;
+    struct timespec now;
+    double elapsed;
+    int count = hybris_libmap_count();
+    int slot;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - _last_report.tv_sec) +
+              (now.tv_nsec - _last_report.tv_nsec) / 1e9;
+    _last_report = now;
+
+    fprintf(out, "libhybris: heap usage by library (pid %d)\n", getpid());
+    fprintf(out, "%-40s %12s %12s %14s %12s %10s\n",
+            "library", "live", "peak", "allocated", "allocs", "allocs/s");
+
+    pthread_mutex_lock(&_threads_mutex);
+    for (slot = 0; slot < count; slot++) {
+        unsigned long allocs = 0;
+        unsigned long long bytes = 0;
+        long live = _live[slot];
+
+        /* the other threads' counters move while we read them, which only
+         * makes the figures a little off */
+        for (stats = _threads; stats != NULL; stats = stats->next) {
+            allocs += stats->allocs[slot];
+            bytes += stats->bytes[slot];
+            live += stats->pending[slot];
+        }
+
+        if (allocs == 0)
+            continue;
+
+        _update_peak(slot, live);
+
+        fprintf(out, "%-40s %12ld %12ld %14llu %12lu %10.0f\n",
+                hybris_libmap_name(slot), live, _peak[slot], bytes, allocs,
+                elapsed > 0 ? (allocs - _last_allocs[slot]) / elapsed : 0);
+
+        _last_allocs[slot] = allocs;
+    }
+    pthread_mutex_unlock(&_threads_mutex);
+}
+
+static void __attribute__((constructor)) _hybris_heap_init(void)
+{
+    const char *env = getenv("HYBRIS_MALLOC_STATS");
+
+    if (env == NULL || strcmp(env, "1") != 0)
+        return;
+
+    if (pthread_key_create(&_threads_key, _thread_stats_retire) != 0)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &_last_report);
+    hybris_libmap_add_report(_heap_report);
+    hybris_heap_enabled = 1;
+
+    LOGD("Per-library heap accounting enabled");
+}
+
+// vim:ts=4:sw=4:noexpandtab
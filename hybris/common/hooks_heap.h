@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef HOOKS_HEAP_H_
+#define HOOKS_HEAP_H_
+
+#include <stddef.h>
+
+/*
+ * Per-library heap accounting, enabled by setting HYBRIS_MALLOC_STATS=1.
+ *
+ * Each allocation gets a small header recording its size and the library
+ * which made it (looked up from the caller's return address), so live and
+ * peak bytes can be tracked per library. Threads count into tables of their
+ * own and only merge into the totals every 64 KiB of change, so live and
+ * peak are exact to that much per thread. The setting is read once at load
+ * time: memory allocated with and without headers must never be mixed.
+ * The report is printed at exit and on HYBRIS_STATS_SIGNAL.
+ */
+extern int hybris_heap_enabled;
+
+void *hybris_heap_malloc(size_t size, const void *caller);
+void *hybris_heap_calloc(size_t nmemb, size_t size, const void *caller);
+void *hybris_heap_realloc(void *ptr, size_t size, const void *caller);
+void *hybris_heap_memalign(size_t alignment, size_t size, const void *caller);
+void hybris_heap_free(void *ptr);
+
+#endif
+
+// vim:ts=4:sw=4:noexpandtab
@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "hooks_libmap.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+
+/* Debug */
+#include "logging.h"
+#define LOGD(message, ...) HYBRIS_DEBUG_LOG(HOOKS, message, ##__VA_ARGS__)
+
+#define LIBMAP_NAME_LEN 128
+#define LIBMAP_CACHE_SIZE 4
+#define LIBMAP_MAX_REPORTS 8
+
+/*
+ * The soinfo layout differs between the gingerbread, ics and jb linkers,
+ * but all of them start with these fields, which is all we need here.
+ */
+struct libmap_soinfo {
+    const char name[LIBMAP_NAME_LEN];
+    void *phdr;
+    int phnum;
+    unsigned entry;
+    unsigned base;
+    unsigned size;
+};
+
+extern struct libmap_soinfo *find_containing_library(const void *addr);
+
+struct libmap_range {
+    uintptr_t base;
+    uintptr_t size;
+    int slot;
+};
+
+static char _names[HYBRIS_LIBMAP_MAX][LIBMAP_NAME_LEN] = { "<unknown>" };
+static int _count = 1;
+static pthread_mutex_t _slots_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct libmap_range _cache[LIBMAP_CACHE_SIZE];
+static __thread unsigned int _cache_next;
+
+static void (*_reports[LIBMAP_MAX_REPORTS])(FILE *out);
+static int _report_count = 0;
+static pthread_mutex_t _reports_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int _report_pipe[2] = { -1, -1 };
+
+static int _lookup_slot(const char *name)
+{
+    int slot;
+
+    pthread_mutex_lock(&_slots_mutex);
+
+    for (slot = 1; slot < _count; slot++) {
+        if (strcmp(_names[slot], name) == 0)
+            goto out;
+    }
+
+    if (_count == HYBRIS_LIBMAP_MAX) {
+        slot = HYBRIS_LIBMAP_UNKNOWN;
+        goto out;
+    }
+
+    strncpy(_names[slot], name, LIBMAP_NAME_LEN - 1);
+    /* Make the name visible before readers can see the new count */
+    __sync_synchronize();
+    _count++;
+
+    LOGD("Library %s registered as slot %d", name, slot);
+
+out:
+    pthread_mutex_unlock(&_slots_mutex);
+    return slot;
+}
+
+int hybris_libmap_slot(const void *addr)
+{
+    struct libmap_soinfo *si;
+    struct libmap_range *range;
+    unsigned int i;
+
+    for (i = 0; i < LIBMAP_CACHE_SIZE; i++) {
+        if ((uintptr_t) addr - _cache[i].base < _cache[i].size)
+            return _cache[i].slot;
+    }
+
+    /*
+     * Libraries are keyed by name rather than by soinfo, so a library that
+     * is unloaded and loaded again keeps its slot.
+     */
+    si = find_containing_library(addr);
+    if (si == NULL)
+        return HYBRIS_LIBMAP_UNKNOWN;
+
+    range = &_cache[_cache_next++ % LIBMAP_CACHE_SIZE];
+    range->base = si->base;
+    range->size = si->size;
+    range->slot = _lookup_slot(si->name);
+
+    return range->slot;
+}
+
+const char *hybris_libmap_name(int slot)
+{
+    if (slot < 0 || slot >= _count)
+        return _names[HYBRIS_LIBMAP_UNKNOWN];
+
+    return _names[slot];
+}
+
+const char *hybris_libmap_lookup(const void *addr, unsigned long *offset)
+{
+    struct libmap_soinfo *si = find_containing_library(addr);
+
+    if (si == NULL)
+        return NULL;
+
+    *offset = (uintptr_t) addr - si->base;
+    return si->name;
+}
+
+int hybris_libmap_count(void)
+{
+    int count = _count;
+
+    __sync_synchronize();
+    return count;
+}
+
+static void _run_reports(void)
+{
+    int i;
+
+    pthread_mutex_lock(&_reports_mutex);
+    for (i = 0; i < _report_count; i++)
+        _reports[i](stderr);
+    fflush(stderr);
+    pthread_mutex_unlock(&_reports_mutex);
+}
+
+static void _report_signal_handler(int sig)
+{
+    char c = 0;
+
+    /* Only async-signal-safe work here, the reporter thread does the rest */
+    if (write(_report_pipe[1], &c, 1) < 0)
+        return;
+}
+
+static void *_report_thread(void *arg)
+{
+    char c;
+
+    while (read(_report_pipe[0], &c, 1) == 1)
+        _run_reports();
+
+    return NULL;
+}
+
+static void _setup_report_signal(void)
+{
+    const char *env = getenv("HYBRIS_STATS_SIGNAL");
+    struct sigaction sa;
+    pthread_t thread;
+    int sig;
+
+    if (env == NULL || (sig = atoi(env)) <= 0)
+        return;
+
+    if (pipe(_report_pipe) != 0)
+        return;
+
+    if (pthread_create(&thread, NULL, _report_thread, NULL) != 0) {
+        close(_report_pipe[0]);
+        close(_report_pipe[1]);
+        return;
+    }
+    pthread_detach(thread);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = _report_signal_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(sig, &sa, NULL);
+
+    LOGD("Printing statistics on signal %d", sig);
+}
+
+void hybris_libmap_print_report(void (*report)(FILE *out))
+{
+    pthread_mutex_lock(&_reports_mutex);
+    report(stderr);
+    fflush(stderr);
+    pthread_mutex_unlock(&_reports_mutex);
+}
+
+void hybris_libmap_add_report(void (*report)(FILE *out))
+{
+    pthread_mutex_lock(&_reports_mutex);
+
+    if (_report_count == 0) {
+        atexit(_run_reports);
+        _setup_report_signal();
+    }
+
+    if (_report_count < LIBMAP_MAX_REPORTS)
+        _reports[_report_count++] = report;
+
+    pthread_mutex_unlock(&_reports_mutex);
+}
+
+// vim:ts=4:sw=4:noexpandtab
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef HOOKS_LIBMAP_H_
+#define HOOKS_LIBMAP_H_
+
+#include <stdio.h>
+
+/* Maximum number of distinct Android libraries tracked, including slot 0 */
+#define HYBRIS_LIBMAP_MAX 128
+
+/* Slot used for callers outside of any Android library, or on overflow */
+#define HYBRIS_LIBMAP_UNKNOWN 0
+
+/*
+ * Map a code address (usually __builtin_return_address(0) in a hook) to a
+ * small per-library slot number, stable for the lifetime of the process.
+ * The last few ranges are cached per thread, so the linker's solist is only
+ * walked when a thread sees a library for the first time.
+ */
+int hybris_libmap_slot(const void *addr);
+
+/* Name of the library registered in a slot, "<unknown>" for slot 0 */
+const char *hybris_libmap_name(int slot);
+
+/*
+ * Name of the Android library containing addr and the offset of addr in
+ * it, or NULL if addr is not in any Android library. Meant for reports,
+ * this always walks the linker's solist.
+ */
+const char *hybris_libmap_lookup(const void *addr, unsigned long *offset);
+
+/* Number of slots handed out so far */
+int hybris_libmap_count(void);
+
+/*
+ * Register a function printing a statistics report. Reports are printed at
+ * exit and, if HYBRIS_STATS_SIGNAL is set to a signal number, every time
+ * the process receives that signal.
+ */
+void hybris_libmap_add_report(void (*report)(FILE *out));
+
+/* Print a single report to stderr, never interleaved with the others */
+void hybris_libmap_print_report(void (*report)(FILE *out));
+
+#endif
+
+// vim:ts=4:sw=4:noexpandtab
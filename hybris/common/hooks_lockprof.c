@@ -0,0 +1,566 @@
+/*
+ * Copyright (C) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "hooks_lockprof.h"
+#include "hooks_libmap.h"
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <unwind.h>
+
+/* Debug */
+#include "logging.h"
+#define LOGD(message, ...) HYBRIS_DEBUG_LOG(HOOKS, message, ##__VA_ARGS__)
+
+#define LOCKPROF_TABLE_SIZE 4096
+#define LOCKPROF_STACK_DEPTH 8
+
+enum lock_kind {
+    LOCK_MUTEX,
+    LOCK_RWLOCK_RD,
+    LOCK_RWLOCK_WR,
+};
+
+static const char *_kind_names[] = { "mutex", "rwlock (read)", "rwlock (write)" };
+
+enum site_state {
+    SITE_FREE,
+    SITE_CLAIMED,
+    SITE_READY,
+};
+
+/*
+ * One entry per contended lock and way of taking it, claimed with a
+ * compare-and-swap on state and only used by others once it is ready.
+ * Only contended acquisitions get here, so plain atomics are cheap enough.
+ */
+struct lock_site {
+    volatile int state;
+    const void *lock;
+    enum lock_kind kind;
+    const void *caller;
+    unsigned long contentions;
+    unsigned long long wait_ns;
+    unsigned long long max_ns;
+    int stack_taken;
+    int depth;
+    void *stack[LOCKPROF_STACK_DEPTH];
+};
+
+int hybris_lockprof_enabled = 0;
+
+static struct lock_site _sites[LOCKPROF_TABLE_SIZE];
+static unsigned long _dropped = 0;
+static int _top = 10;
+
+#ifdef __arm__
+/*
+ * libgcc's unwinder only finds the tables of the host's libraries and stops
+ * at the first frame in a library the hybris linker loaded, which is where
+ * the contended locks are. This walks the ARM EHABI tables itself, getting
+ * those of the Android libraries from the hybris linker.
+ */
+extern _Unwind_Ptr android_dl_unwind_find_exidx(_Unwind_Ptr pc, int *pcount);
+extern _Unwind_Ptr __gnu_Unwind_Find_exidx(_Unwind_Ptr pc, int *pcount);
+
+struct ehabi_regs {
+    uintptr_t r[16];
+    /* bounds of the stack, nothing is read outside of them */
+    uintptr_t stack_lo;
+    uintptr_t stack_hi;
+};
+
+struct ehabi_ops {
+    const uint32_t *next;
+    uint32_t data;
+    int bytes_left;
+    int words_left;
+};
+
+static uintptr_t _prel31(const uint32_t *p)
+{
+    return (uintptr_t) p + (intptr_t) ((int32_t) (*p << 1) >> 1);
+}
+
+static int _ehabi_byte(struct ehabi_ops *ops)
+{
+    int byte;
+
+    if (ops->bytes_left == 0) {
+        if (ops->words_left == 0)
+            return 0xb0; /* finish */
+        ops->data = *ops->next++;
+        ops->words_left--;
+        ops->bytes_left = 4;
+    }
+
+    byte = ops->data >> 24;
+    ops->data <<= 8;
+    ops->bytes_left--;
+    return byte;
+}
+
+/* Pops the registers in mask, lowest first, from vsp */
+static int _ehabi_pop(struct ehabi_regs *regs, uintptr_t *vsp, uint32_t mask, int *pc_set)
+{
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        if (!(mask & (1 << i)))
+            continue;
+        if (*vsp < regs->stack_lo || *vsp + 4 > regs->stack_hi)
+            return -1;
+        regs->r[i] = *(uint32_t *) *vsp;
+        *vsp += 4;
+        if (i == 15)
+            *pc_set = 1;
+    }
+
+    /* popping sp itself replaces vsp */
+    if (mask & (1 << 13))
+        *vsp = regs->r[13];
+
+    return 0;
+}
+
+/* Runs the unwinding instructions of one frame, see the ARM EHABI 10.3 */
+static int _ehabi_execute(struct ehabi_regs *regs, struct ehabi_ops *ops)
+{
+    uintptr_t vsp = regs->r[13];
+    int pc_set = 0;
+
+    for (;;) {
+        int op = _ehabi_byte(ops);
+
+        if ((op & 0xc0) == 0x00) {
+            vsp += ((op & 0x3f) << 2) + 4;
+        } else if ((op & 0xc0) == 0x40) {
+            vsp -= ((op & 0x3f) << 2) + 4;
+        } else if ((op & 0xf0) == 0x80) {
+            uint32_t mask = ((op & 0x0f) << 8 | _ehabi_byte(ops)) << 4;
+
+            if (mask == 0 || _ehabi_pop(regs, &vsp, mask, &pc_set) != 0)
+                return -1;
+        } else if ((op & 0xf0) == 0x90) {
+            if ((op & 0x0f) == 13 || (op & 0x0f) == 15)
+                return -1;
+            vsp = regs->r[op & 0x0f];
+        } else if ((op & 0xf0) == 0xa0) {
+            uint32_t mask = (0xff0 >> (7 - (op & 0x07))) & 0xff0;
+
+            if (op & 0x08)
+                mask |= 1 << 14;
+            if (_ehabi_pop(regs, &vsp, mask, &pc_set) != 0)
+                return -1;
+        } else if (op == 0xb0) {
+            break;
+        } else if (op == 0xb1) {
+            uint32_t mask = _ehabi_byte(ops);
+
+            if (mask == 0 || (mask & 0xf0) || _ehabi_pop(regs, &vsp, mask, &pc_set) != 0)
+                return -1;
+        } else if (op == 0xb2) {
+            uint32_t uleb = 0;
+            int shift = 0, byte;
+
+            do {
+                byte = _ehabi_byte(ops);
+                uleb |= (uint32_t) (byte & 0x7f) << shift;
+                shift += 7;
+            } while ((byte & 0x80) && shift < 32);
+            vsp += 0x204 + (uleb << 2);
+        } else if (op == 0xb3 || op == 0xc8 || op == 0xc9) {
+            /* VFP registers, only their room on the stack matters here */
+            vsp += ((_ehabi_byte(ops) & 0x0f) + 1) * 8 + (op == 0xb3 ? 4 : 0);
+        } else if ((op & 0xf8) == 0xb8) {
+            vsp += ((op & 0x07) + 1) * 8 + 4;
+        } else if ((op & 0xf8) == 0xd0) {
+            vsp += ((op & 0x07) + 1) * 8;
+        } else {
+            /* iWMMXt and spare encodings */
+            return -1;
+        }
+    }
+
+    if (!pc_set)
+        regs->r[15] = regs->r[14];
+    regs->r[13] = vsp;
+    return 0;
+}
+
+/* Finds the table entry of pc and unwinds its frame, 0 on success */
+static int _ehabi_step(struct ehabi_regs *regs, uintptr_t pc)
+{
+    const uint32_t *table, *entry;
+    struct ehabi_ops ops;
+    int count, lo, hi;
+    uint32_t word;
+
+    table = (const uint32_t *) android_dl_unwind_find_exidx(pc, &count);
+    if (table == NULL || count <= 0)
+        table = (const uint32_t *) __gnu_Unwind_Find_exidx(pc, &count);
+    if (table == NULL || count <= 0)
+        return -1;
+
+    /* the last entry starting at or before pc */
+    lo = 0;
+    hi = count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+
+        if (_prel31(&table[mid * 2]) <= pc)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    entry = &table[lo * 2];
+    if (_prel31(entry) > pc || entry[1] == 1 /* EXIDX_CANTUNWIND */)
+        return -1;
+
+    if (entry[1] & 0x80000000) {
+        word = entry[1];
+    } else {
+        const uint32_t *extab = (const uint32_t *) _prel31(&entry[1]);
+
+        word = *extab;
+        if (!(word & 0x80000000)) {
+            /* a personality routine, gcc's keep the opcodes after it */
+            extab++;
+            word = *extab;
+            ops.next = extab + 1;
+            ops.words_left = word >> 24;
+            ops.data = word << 8;
+            ops.bytes_left = 3;
+            return _ehabi_execute(regs, &ops);
+        }
+        ops.next = extab + 1;
+    }
+
+    switch ((word >> 24) & 0x0f) {
+    case 0:
+        ops.words_left = 0;
+        ops.data = word << 8;
+        ops.bytes_left = 3;
+        break;
+    case 1:
+    case 2:
+        if (!(entry[1] & 0x80000000)) {
+            ops.words_left = (word >> 16) & 0xff;
+            ops.data = word << 16;
+            ops.bytes_left = 2;
+            break;
+        }
+        /* fall through, only index 0 can be inline */
+    default:
+        return -1;
+    }
+
+    return _ehabi_execute(regs, &ops);
+}
+
+static int __attribute__((noinline)) _backtrace(void **stack, int skip)
+{
+    struct ehabi_regs regs;
+    pthread_attr_t attr;
+    void *stack_addr;
+    size_t stack_size;
+    int depth = 0, first = 1;
+
+    if (pthread_getattr_np(pthread_self(), &attr) != 0)
+        return 0;
+    pthread_attr_getstack(&attr, &stack_addr, &stack_size);
+    pthread_attr_destroy(&attr);
+    regs.stack_lo = (uintptr_t) stack_addr;
+    regs.stack_hi = regs.stack_lo + stack_size;
+
+    /* our own frame, as set up by the prologue, is the first to unwind */
+    __asm__ volatile ("stmia %0, {r4-r11}" : : "r" (&regs.r[4]) : "memory");
+    __asm__ volatile ("mov %0, sp" : "=r" (regs.r[13]));
+    regs.r[14] = 0;
+    regs.r[15] = (uintptr_t) _backtrace;
+
+    while (depth < LOCKPROF_STACK_DEPTH) {
+        uintptr_t sp = regs.r[13];
+        /* return addresses point after the call, which may end a function */
+        uintptr_t pc = (regs.r[15] & ~1) - (first ? 0 : 2);
+
+        if (_ehabi_step(&regs, pc) != 0 || regs.r[15] == 0 || regs.r[13] < sp ||
+            (regs.r[13] == sp && (regs.r[15] & ~1) == pc + (first ? 0 : 2)))
+            break;
+        first = 0;
+
+        if (skip > 0)
+            skip--;
+        else
+            stack[depth++] = (void *) (regs.r[15] & ~1);
+    }
+
+    return depth;
+}
+#else
+struct lock_backtrace {
+    void **stack;
+    int depth;
+    int skip;
+};
+
+static _Unwind_Reason_Code _backtrace_frame(struct _Unwind_Context *context, void *data)
+{
+    struct lock_backtrace *bt = data;
+    uintptr_t pc = _Unwind_GetIP(context);
+
+    if (bt->skip > 0) {
+        bt->skip--;
+        return _URC_NO_REASON;
+    }
+
+    if (pc == 0 || bt->depth == LOCKPROF_STACK_DEPTH)
+        return _URC_END_OF_STACK;
+
+    bt->stack[bt->depth++] = (void *) pc;
+    return _URC_NO_REASON;
+}
+
+static int __attribute__((noinline)) _backtrace(void **stack, int skip)
+{
+    /* and this frame too */
+    struct lock_backtrace bt = { stack, 0, skip + 1 };
+
+    _Unwind_Backtrace(_backtrace_frame, &bt);
+    return bt.depth;
+}
+#endif
+
+static struct lock_site *_site(const void *lock, enum lock_kind kind)
+{
+    uintptr_t hash = (((uintptr_t) lock >> 3) ^ kind) * 2654435761U;
+    unsigned int i, index;
+
+    for (i = 0; i < LOCKPROF_TABLE_SIZE; i++) {
+        struct lock_site *site;
+
+        index = (hash + i) & (LOCKPROF_TABLE_SIZE - 1);
+        site = &_sites[index];
+
+        if (site->state == SITE_FREE &&
+            __sync_bool_compare_and_swap(&site->state, SITE_FREE, SITE_CLAIMED)) {
+            site->lock = lock;
+            site->kind = kind;
+            __sync_synchronize();
+            site->state = SITE_READY;
+            return site;
+        }
+
+        /* another thread is filling it in, maybe for this very lock */
+        while (site->state == SITE_CLAIMED)
+            sched_yield();
+        __sync_synchronize();
+
+        if (site->lock == lock && site->kind == kind)
+            return site;
+    }
+
+    __sync_fetch_and_add(&_dropped, 1);
+    return NULL;
+}
+
+static void _account(const void *lock, enum lock_kind kind, const void *caller,
+                     const struct timespec *start)
+{
+    struct lock_site *site = _site(lock, kind);
+    struct timespec now;
+    unsigned long long ns, max;
+
+    if (site == NULL)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = (now.tv_sec - start->tv_sec) * 1000000000ULL + now.tv_nsec - start->tv_nsec;
+
+    HYBRIS_METRIC_RECORD("hooks.lock_wait_us", ns / 1000);
+
+    __sync_fetch_and_add(&site->contentions, 1);
+    __sync_fetch_and_add(&site->wait_ns, ns);
+
+    max = site->max_ns;
+    while (ns > max && !__sync_bool_compare_and_swap(&site->max_ns, max, ns))
+        max = site->max_ns;
+
+    /* The first contended caller gets to record its stack */
+    if (__sync_bool_compare_and_swap(&site->stack_taken, 0, 1)) {
+        /* leave out _account() and the lock function */
+        int depth = _backtrace(site->stack, 2);
+
+        site->caller = caller;
+        __sync_synchronize();
+        site->depth = depth;
+    }
+}
+
+int hybris_lockprof_mutex_lock(pthread_mutex_t *realmutex, const void *lock,
+                               const void *caller)
+{
+    struct timespec start;
+    int ret;
+
+    ret = pthread_mutex_trylock(realmutex);
+    if (ret != EBUSY)
+        return ret;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = pthread_mutex_lock(realmutex);
+    _account(lock, LOCK_MUTEX, caller, &start);
+
+    return ret;
+}
+
+int hybris_lockprof_rwlock_rdlock(pthread_rwlock_t *realrwlock, const void *lock,
+                                  const void *caller)
+{
+    struct timespec start;
+    int ret;
+
+    ret = pthread_rwlock_tryrdlock(realrwlock);
+    if (ret != EBUSY)
+        return ret;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = pthread_rwlock_rdlock(realrwlock);
+    _account(lock, LOCK_RWLOCK_RD, caller, &start);
+
+    return ret;
+}
+
+int hybris_lockprof_rwlock_wrlock(pthread_rwlock_t *realrwlock, const void *lock,
+                                  const void *caller)
+{
+    struct timespec start;
+    int ret;
+
+    ret = pthread_rwlock_trywrlock(realrwlock);
+    if (ret != EBUSY)
+        return ret;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = pthread_rwlock_wrlock(realrwlock);
+    _account(lock, LOCK_RWLOCK_WR, caller, &start);
+
+    return ret;
+}
+
+static void _print_address(FILE *out, const char *prefix, const void *addr)
+{
+    unsigned long offset;
+    const char *lib = hybris_libmap_lookup(addr, &offset);
+
+    if (lib != NULL)
+        fprintf(out, "%s%p %s+0x%lx\n", prefix, addr, lib, offset);
+    else
+        fprintf(out, "%s%p\n", prefix, addr);
+}
+
+static int _compare_wait(const void *a, const void *b)
+{
+    const struct lock_site *sa = *(const struct lock_site * const *) a;
+    const struct lock_site *sb = *(const struct lock_site * const *) b;
+
+    if (sa->wait_ns == sb->wait_ns)
+        return 0;
+    return sa->wait_ns < sb->wait_ns ? 1 : -1;
+}
+
+static void _lockprof_report(FILE *out)
+{
+    struct lock_site *sorted[LOCKPROF_TABLE_SIZE];
+    int count = 0, i, j;
+
+    for (i = 0; i < LOCKPROF_TABLE_SIZE; i++) {
+        if (_sites[i].state == SITE_READY && _sites[i].contentions > 0)
+            sorted[count++] = &_sites[i];
+    }
+
+    qsort(sorted, count, sizeof(sorted[0]), _compare_wait);
+
+    fprintf(out, "libhybris: %d contended locks (pid %d), top %d by wait time\n",
+            count, getpid(), count < _top ? count : _top);
+    if (_dropped)
+        fprintf(out, "libhybris: %lu contentions not tracked, table full\n", _dropped);
+
+    for (i = 0; i < count && i < _top; i++) {
+        struct lock_site *site = sorted[i];
+        int depth = site->depth;
+
+        __sync_synchronize();
+
+        fprintf(out, "#%d %s %p: %lu contentions, %.3f ms total, %.1f us avg, %.1f us max\n",
+                i + 1, _kind_names[site->kind], site->lock, site->contentions,
+                site->wait_ns / 1e6, site->wait_ns / 1e3 / site->contentions,
+                site->max_ns / 1e3);
+        if (site->caller != NULL)
+            _print_address(out, "    called from ", site->caller);
+        for (j = 0; j < depth; j++)
+            _print_address(out, "      ", site->stack[j]);
+    }
+}
+
+static void *_lockprof_thread(void *arg)
+{
+    unsigned int interval = (unsigned int) (uintptr_t) arg;
+
+    for (;;) {
+        sleep(interval);
+        hybris_libmap_print_report(_lockprof_report);
+    }
+
+    return NULL;
+}
+
+static void __attribute__((constructor)) _hybris_lockprof_init(void)
+{
+    const char *env = getenv("HYBRIS_LOCKPROF");
+    pthread_t thread;
+    int interval;
+
+    if (env == NULL || strcmp(env, "1") != 0)
+        return;
+
+    env = getenv("HYBRIS_LOCKPROF_TOP");
+    if (env != NULL && atoi(env) > 0)
+        _top = atoi(env);
+
+    hybris_libmap_add_report(_lockprof_report);
+    hybris_lockprof_enabled = 1;
+
+    env = getenv("HYBRIS_LOCKPROF_INTERVAL");
+    interval = env ? atoi(env) : 0;
+    if (interval > 0 &&
+        pthread_create(&thread, NULL, _lockprof_thread, (void *) (uintptr_t) interval) == 0)
+        pthread_detach(thread);
+
+    LOGD("Lock contention profiling enabled");
+}
+
+// vim:ts=4:sw=4:noexpandtab
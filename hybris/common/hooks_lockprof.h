@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef HOOKS_LOCKPROF_H_
+#define HOOKS_LOCKPROF_H_
+
+#include <pthread.h>
+
+/*
+ * Contention profiler for the mutexes and rwlocks of Android code, enabled
+ * by setting HYBRIS_LOCKPROF=1.
+ *
+ * Locks are try-locked first; only when that fails is the wait timed and
+ * accounted to the Android-side lock address, together with the library
+ * and stack of the first contended caller. The locks with the most wait
+ * time are reported at exit, on HYBRIS_STATS_SIGNAL and, if set, every
+ * HYBRIS_LOCKPROF_INTERVAL seconds. HYBRIS_LOCKPROF_TOP sets how many
+ * locks are listed (default 10).
+ */
+extern int hybris_lockprof_enabled;
+
+/* lock is the address the Android code uses, caller its return address */
+int hybris_lockprof_mutex_lock(pthread_mutex_t *realmutex, const void *lock,
+                               const void *caller);
+int hybris_lockprof_rwlock_rdlock(pthread_rwlock_t *realrwlock, const void *lock,
+                                  const void *caller);
+int hybris_lockprof_rwlock_wrlock(pthread_rwlock_t *realrwlock, const void *lock,
+                                  const void *caller);
+
+#endif
+
+// vim:ts=4:sw=4:noexpandtab
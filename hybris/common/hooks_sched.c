@@ -0,0 +1,309 @@
+/*
+ * Copyright (C) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "hooks_sched.h"
+#include "hooks_libmap.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+
+/* Debug */
+#include "logging.h"
+#define LOGD(message, ...) HYBRIS_DEBUG_LOG(HOOKS, message, ##__VA_ARGS__)
+#define LOGI(message, ...) HYBRIS_INFO_LOG(HOOKS, message, ##__VA_ARGS__)
+
+#define MAX_RULES 32
+
+struct thread_rule {
+    char lib[64];
+    char name[32];
+    int has_cpus;
+    cpu_set_t cpus;
+    int has_nice;
+    int nice;
+    int fifo;
+};
+
+struct thread_start {
+    void *(*start_routine)(void*);
+    void *arg;
+    int slot;
+};
+
+int hybris_thread_policy_enabled = 0;
+
+static struct thread_rule _rules[MAX_RULES];
+static int _rule_count = 0;
+
+/* Library which created the current thread, for rules matched on naming */
+static __thread int _thread_slot = -1;
+
+static int _parse_cpus(const char *list, cpu_set_t *cpus)
+{
+    char *end;
+    long first, last;
+
+    CPU_ZERO(cpus);
+
+    while (*list) {
+        first = strtol(list, &end, 10);
+        if (end == list || first < 0)
+            return -1;
+
+        last = first;
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list || last < first)
+                return -1;
+        }
+
+        for (; first <= last && first < CPU_SETSIZE; first++)
+            CPU_SET(first, cpus);
+
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return -1;
+        list = end;
+    }
+
+    return 0;
+}
+
+static void _parse_rule(char *line)
+{
+    struct thread_rule *rule = &_rules[_rule_count];
+    char *saveptr = NULL;
+    char *token;
+
+    if (strchr(line, '#'))
+        *strchr(line, '#') = '\0';
+
+    if (_rule_count == MAX_RULES) {
+        fprintf(stderr, "libhybris: too many thread policy rules\n");
+        return;
+    }
+
+    memset(rule, 0, sizeof(*rule));
+
+    for (token = strtok_r(line, " \t\r\n", &saveptr); token != NULL;
+         token = strtok_r(NULL, " \t\r\n", &saveptr)) {
+        char *value = strchr(token, '=');
+
+        if (value == NULL)
+            goto invalid;
+        *value++ = '\0';
+
+        if (strcmp(token, "lib") == 0) {
+            strncpy(rule->lib, value, sizeof(rule->lib) - 1);
+        } else if (strcmp(token, "name") == 0) {
+            strncpy(rule->name, value, sizeof(rule->name) - 1);
+        } else if (strcmp(token, "cpus") == 0) {
+            if (_parse_cpus(value, &rule->cpus) != 0)
+                goto invalid;
+            rule->has_cpus = 1;
+        } else if (strcmp(token, "nice") == 0) {
+            rule->nice = atoi(value);
+            rule->has_nice = 1;
+        } else if (strcmp(token, "fifo") == 0) {
+            rule->fifo = atoi(value);
+            if (rule->fifo <= 0)
+                goto invalid;
+        } else {
+            goto invalid;
+        }
+    }
+
+    if (!rule->lib[0] && !rule->name[0])
+        return;
+
+    _rule_count++;
+    return;
+
+invalid:
+    fprintf(stderr, "libhybris: ignoring invalid thread policy rule (at '%s')\n", token);
+}
+
+static const char *_basename(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+
+    return slash ? slash + 1 : path;
+}
+
+static const struct thread_rule *_match(int slot, const char *name)
+{
+    int i;
+
+    for (i = 0; i < _rule_count; i++) {
+        const struct thread_rule *rule = &_rules[i];
+
+        /* Rules with a name only apply once the thread is named */
+        if (rule->name[0] && (name == NULL || fnmatch(rule->name, name, 0) != 0))
+            continue;
+        if (!rule->name[0] && name != NULL)
+            continue;
+
+        if (rule->lib[0] && (slot < 0 ||
+            fnmatch(rule->lib, _basename(hybris_libmap_name(slot)), 0) != 0))
+            continue;
+
+        return rule;
+    }
+
+    return NULL;
+}
+
+static const char *_lib_name(int slot)
+{
+    return slot >= 0 ? hybris_libmap_name(slot) : "?";
+}
+
+/*
+ * tid is only known for the calling thread, for other threads the nice
+ * value can't be changed.
+ */
+static void _apply(const struct thread_rule *rule, pthread_t thread, pid_t tid,
+                   int slot, const char *name)
+{
+    if (rule->has_cpus) {
+        if (pthread_setaffinity_np(thread, sizeof(rule->cpus), &rule->cpus) == 0) {
+            LOGI("Thread %s of %s: CPU affinity set", name ? name : "", _lib_name(slot));
+        } else {
+            LOGD("Thread %s of %s: failed to set CPU affinity", name ? name : "", _lib_name(slot));
+        }
+    }
+
+    if (rule->has_nice && tid > 0) {
+        if (setpriority(PRIO_PROCESS, tid, rule->nice) == 0) {
+            LOGI("Thread %s of %s: nice %d", name ? name : "", _lib_name(slot), rule->nice);
+        } else {
+            LOGD("Thread %s of %s: failed to set nice %d", name ? name : "", _lib_name(slot), rule->nice);
+        }
+    }
+
+    if (rule->fifo) {
+        struct sched_param param;
+
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = rule->fifo;
+        if (pthread_setschedparam(thread, SCHED_FIFO, &param) == 0) {
+            LOGI("Thread %s of %s: SCHED_FIFO %d", name ? name : "", _lib_name(slot), rule->fifo);
+        } else {
+            LOGD("Thread %s of %s: failed to set SCHED_FIFO %d", name ? name : "", _lib_name(slot), rule->fifo);
+        }
+    }
+}
+
+static void *_thread_start(void *data)
+{
+    struct thread_start start = *(struct thread_start *) data;
+    const struct thread_rule *rule;
+
+    free(data);
+
+    _thread_slot = start.slot;
+
+    rule = _match(start.slot, NULL);
+    if (rule != NULL)
+        _apply(rule, pthread_self(), syscall(SYS_gettid), start.slot, NULL);
+
+    return start.start_routine(start.arg);
+}
+
+int hybris_thread_policy_create(pthread_t *thread, const pthread_attr_t *attr,
+                                void *(*start_routine)(void*), void *arg)
+{
+    struct thread_start *start;
+    int ret;
+
+    start = malloc(sizeof(*start));
+    if (start == NULL)
+        return pthread_create(thread, attr, start_routine, arg);
+
+    start->start_routine = start_routine;
+    start->arg = arg;
+    start->slot = hybris_libmap_slot(start_routine);
+
+    ret = pthread_create(thread, attr, _thread_start, start);
+    if (ret != 0)
+        free(start);
+
+    return ret;
+}
+
+void hybris_thread_policy_setname(pthread_t thread, const char *name)
+{
+    const struct thread_rule *rule;
+
+    if (pthread_equal(thread, pthread_self())) {
+        rule = _match(_thread_slot, name);
+        if (rule != NULL)
+            _apply(rule, thread, syscall(SYS_gettid), _thread_slot, name);
+    } else {
+        rule = _match(-1, name);
+        if (rule != NULL)
+            _apply(rule, thread, 0, -1, name);
+    }
+}
+
+static void __attribute__((constructor)) _hybris_thread_policy_init(void)
+{
+    const char *env = getenv("HYBRIS_THREAD_POLICY");
+    const char *path = getenv("HYBRIS_THREAD_POLICY_FILE");
+    char line[256];
+    FILE *fp;
+
+    if (env != NULL) {
+        char *rules = strdup(env);
+        char *saveptr = NULL;
+        char *rule;
+
+        for (rule = strtok_r(rules, ";", &saveptr); rule != NULL;
+             rule = strtok_r(NULL, ";", &saveptr))
+            _parse_rule(rule);
+
+        free(rules);
+    }
+
+    if (path != NULL) {
+        fp = fopen(path, "r");
+        if (fp == NULL) {
+            fprintf(stderr, "libhybris: can't open thread policy %s\n", path);
+        } else {
+            while (fgets(line, sizeof(line), fp) != NULL)
+                _parse_rule(line);
+            fclose(fp);
+        }
+    }
+
+    if (_rule_count > 0) {
+        LOGD("Loaded %d thread policy rules", _rule_count);
+        hybris_thread_policy_enabled = 1;
+    }
+}
+
+// vim:ts=4:sw=4:noexpandtab
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef HOOKS_SCHED_H_
+#define HOOKS_SCHED_H_
+
+#include <pthread.h>
+
+/*
+ * Placement policy for threads created by Android libraries.
+ *
+ * Rules come from HYBRIS_THREAD_POLICY (separated by ';') or from the file
+ * named by HYBRIS_THREAD_POLICY_FILE (one per line, '#' starts a comment).
+ * A rule is a list of key=value pairs separated by blanks:
+ *
+ *   lib=<pattern>   library containing the thread's start routine
+ *   name=<pattern>  name given with pthread_setname_np()
+ *   cpus=<list>     CPU affinity, e.g. 0-3 or 4,6
+ *   nice=<n>        nice value
+ *   fifo=<prio>     SCHED_FIFO with the given priority
+ *
+ * Patterns are shell wildcards, lib= is matched against the basename.
+ * Rules without name= are applied when the thread starts, rules with
+ * name= when it gets named. The first matching rule wins.
+ */
+extern int hybris_thread_policy_enabled;
+
+int hybris_thread_policy_create(pthread_t *thread, const pthread_attr_t *attr,
+                                void *(*start_routine)(void*), void *arg);
+void hybris_thread_policy_setname(pthread_t thread, const char *name);
+
+#endif
+
+// vim:ts=4:sw=4:noexpandtab
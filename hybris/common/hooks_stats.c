@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "hooks_stats.h"
+#include "hooks_libmap.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* Debug */
+#include "logging.h"
+#define LOGD(message, ...) HYBRIS_DEBUG_LOG(HOOKS, message, ##__VA_ARGS__)
+
+static const char *_stat_names[HOOK_STAT_MAX] = {
+    "pthread_mutex_lock",
+    "pthread_cond_wait",
+    "pthread_cond_timedwait",
+    "pthread_rwlock_rdlock",
+    "pthread_rwlock_wrlock",
+    "fopen",
+    "fread",
+    "fwrite",
+    "fgets",
+};
+
+struct hook_counters {
+    unsigned long calls;
+    unsigned long samples;
+    unsigned long long bytes;
+    unsigned long long sampled_ns;
+    unsigned long long max_ns;
+};
+
+/*
+ * Rows are allocated the first time a thread sees a library, only the
+ * owning thread writes to them. Tables of exited threads are recycled.
+ */
+struct hook_thread_stats {
+    struct hook_thread_stats *next;
+    int retired;
+    unsigned int tick;
+    struct hook_counters *rows[HYBRIS_LIBMAP_MAX];
+};
+
+int hybris_hook_stats_enabled = 0;
+
+static unsigned int _sample_rate = 16;
+
+static struct hook_thread_stats *_threads = NULL;
+static pthread_mutex_t _threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t _threads_key;
+
+static __thread struct hook_thread_stats *_stats;
+static __thread int _stats_exiting;
+
+static void _thread_stats_retire(void *data)
+{
+    struct hook_thread_stats *stats = data;
+
+    pthread_mutex_lock(&_threads_mutex);
+    stats->retired = 1;
+    pthread_mutex_unlock(&_threads_mutex);
+
+    _stats = NULL;
+    _stats_exiting = 1;
+}
+
+static struct hook_thread_stats *_thread_stats(void)
+{
+    struct hook_thread_stats *stats;
+
+    if (_stats != NULL || _stats_exiting)
+        return _stats;
+
+    pthread_mutex_lock(&_threads_mutex);
+    for (stats = _threads; stats != NULL; stats = stats->next) {
+        if (stats->retired) {
+            stats->retired = 0;
+            break;
+        }
+    }
+    if (stats == NULL) {
+        stats = calloc(1, sizeof(*stats));
+        if (stats != NULL) {
+            stats->next = _threads;
+            _threads = stats;
+        }
+    }
+    pthread_mutex_unlock(&_threads_mutex);
+
+    if (stats != NULL)
+        pthread_setspecific(_threads_key, stats);
+
+    _stats = stats;
+    return stats;
+}
+
+static struct hook_counters *_counters(struct hook_thread_stats *stats, int slot,
+                                       enum hybris_hook_stat stat)
+{
+    struct hook_counters *row = stats->rows[slot];
+
+    if (row == NULL) {
+        row = calloc(HOOK_STAT_MAX, sizeof(*row));
+        if (row == NULL)
+            return NULL;
+
+        /* The report may walk the rows concurrently */
+        __sync_synchronize();
+        stats->rows[slot] = row;
+    }
+
+    return &row[stat];
+}
+
+void hybris_hook_stats_begin(struct hybris_hook_call *call,
+                             enum hybris_hook_stat stat, const void *caller)
+{
+    struct hook_thread_stats *stats = _thread_stats();
+
+    call->stat = stat;
+    call->slot = hybris_libmap_slot(caller);
+    call->sampled = stats != NULL && (++stats->tick % _sample_rate) == 0;
+
+    if (call->sampled)
+        clock_gettime(CLOCK_MONOTONIC, &call->start);
+}
+
+void hybris_hook_stats_end(struct hybris_hook_call *call, size_t bytes)
+{
+    struct hook_thread_stats *stats = _thread_stats();
+    struct hook_counters *counters;
+    struct timespec now;
+    unsigned long long ns;
+
+    if (stats == NULL)
+        return;
+
+    counters = _counters(stats, call->slot, call->stat);
+    if (counters == NULL)
+        return;
+
+    counters->calls++;
+    counters->bytes += bytes;
+
+    if (!call->sampled)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = (now.tv_sec - call->start.tv_sec) * 1000000000ULL +
+         now.tv_nsec - call->start.tv_nsec;
+
+    counters->samples++;
+    counters->sampled_ns += ns;
+    if (ns > counters->max_ns)
+        counters->max_ns = ns;
+}
+
+static void _hook_stats_report(FILE *out)
+{
+    struct hook_thread_stats *stats;
+    int count = hybris_libmap_count();
+    int slot, stat;
+
+    fprintf(out, "libhybris: hook calls by library (pid %d, 1/%u calls timed)\n",
+            getpid(), _sample_rate);
+    fprintf(out, "%-40s %-24s %12s %12s %12s %14s\n",
+            "library", "hook", "calls", "avg us", "max us", "bytes");
+
+    pthread_mutex_lock(&_threads_mutex);
+    for (slot = 0; slot < count; slot++) {
+        for (stat = 0; stat < HOOK_STAT_MAX; stat++) {
+            struct hook_counters total;
+
+            memset(&total, 0, sizeof(total));
+            for (stats = _threads; stats != NULL; stats = stats->next) {
+                struct hook_counters *row = stats->rows[slot];
+
+                if (row == NULL)
+                    continue;
+
+                total.calls += row[stat].calls;
+                total.samples += row[stat].samples;
+                total.bytes += row[stat].bytes;
+                total.sampled_ns += row[stat].sampled_ns;
+                if (row[stat].max_ns > total.max_ns)
+                    total.max_ns = row[stat].max_ns;
+            }
+
+            if (total.calls == 0)
+                continue;
+
+            fprintf(out, "%-40s %-24s %12lu %12.1f %12.1f %14llu\n",
+                    hybris_libmap_name(slot), _stat_names[stat], total.calls,
+                    total.samples ? total.sampled_ns / 1000.0 / total.samples : 0,
+                    total.max_ns / 1000.0, total.bytes);
+        }
+    }
+    pthread_mutex_unlock(&_threads_mutex);
+}
+
+static void __attribute__((constructor)) _hybris_hook_stats_init(void)
+{
+    const char *env = getenv("HYBRIS_HOOK_STATS");
+
+    if (env == NULL || strcmp(env, "1") != 0)
+        return;
+
+    env = getenv("HYBRIS_HOOK_STATS_SAMPLE");
+    if (env != NULL && atoi(env) > 0)
+        _sample_rate = atoi(env);
+
+    if (pthread_key_create(&_threads_key, _thread_stats_retire) != 0)
+        return;
+
+    hybris_libmap_add_report(_hook_stats_report);
+    hybris_hook_stats_enabled = 1;
+
+    LOGD("Hook statistics enabled, timing 1 in %u calls", _sample_rate);
+}
+
+// vim:ts=4:sw=4:noexpandtab
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef HOOKS_STATS_H_
+#define HOOKS_STATS_H_
+
+#include <stddef.h>
+#include <time.h>
+
+/*
+ * Call counters and sampled latency for selected hooks, per calling
+ * library. Enabled by setting HYBRIS_HOOK_STATS=1; one call in
+ * HYBRIS_HOOK_STATS_SAMPLE (default 16) per thread is timed. The table is
+ * printed at exit and on HYBRIS_STATS_SIGNAL.
+ */
+enum hybris_hook_stat {
+    HOOK_STAT_MUTEX_LOCK,
+    HOOK_STAT_COND_WAIT,
+    HOOK_STAT_COND_TIMEDWAIT,
+    HOOK_STAT_RWLOCK_RDLOCK,
+    HOOK_STAT_RWLOCK_WRLOCK,
+    HOOK_STAT_FOPEN,
+    HOOK_STAT_FREAD,
+    HOOK_STAT_FWRITE,
+    HOOK_STAT_FGETS,
+    HOOK_STAT_MAX
+};
+
+struct hybris_hook_call {
+    enum hybris_hook_stat stat;
+    int slot;
+    int sampled;
+    struct timespec start;
+};
+
+extern int hybris_hook_stats_enabled;
+
+void hybris_hook_stats_begin(struct hybris_hook_call *call,
+                             enum hybris_hook_stat stat, const void *caller);
+void hybris_hook_stats_end(struct hybris_hook_call *call, size_t bytes);
+
+/*
+ * To be used in pairs around the call to the real function in a hook.
+ * When disabled this is a single flag check on each side.
+ */
+#define HOOK_STATS_BEGIN(stat) \
+    struct hybris_hook_call _hook_call; \
+    if (hybris_hook_stats_enabled) \
+        hybris_hook_stats_begin(&_hook_call, stat, __builtin_return_address(0))
+
+#define HOOK_STATS_END(bytes) \
+    if (hybris_hook_stats_enabled) \
+        hybris_hook_stats_end(&_hook_call, bytes)
+
+#endif
+
+// vim:ts=4:sw=4:noexpandtab
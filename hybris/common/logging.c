@@ -23,6 +23,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <pthread.h>
+#include <signal.h>
 
 FILE *hybris_logging_target = NULL;
 
@@ -35,9 +36,68 @@ static enum hybris_log_format _hybris_logging_format = HYBRIS_LOG_FORMAT_NORMAL;
 
 static int _hybris_should_trace = 0;
 
+/* HYBRIS_TRACE, when it lists modules or tracepoints rather than "1" */
+static char *_hybris_trace_filter = NULL;
+
+/* tracepoint sites hit so far, only ever pushed to */
+static struct hybris_tracepoint *_hybris_tracepoints = NULL;
+
+static int _hybris_logging_async = 0;
+
 static int
 hybris_logging_initialized = 0;
 
+/**
+ * Whether HYBRIS_TRACE selects the given tracepoint. Only touches memory,
+ * as it runs from the signal handler too.
+ **/
+static int
+hybris_trace_filter_match(const char *module, const char *tracepoint)
+{
+    const char *entry = _hybris_trace_filter;
+
+    if (!_hybris_should_trace)
+        return 0;
+    if (entry == NULL)
+        return 1;
+
+    while (*entry) {
+        size_t len = strcspn(entry, ",");
+        size_t module_len = strcspn(entry, ":,");
+
+        if (strncmp(entry, module, module_len) == 0 && module[module_len] == '\0') {
+            /* "module" alone selects all its tracepoints */
+            if (module_len == len)
+                return 1;
+            if (strncmp(entry + module_len + 1, tracepoint, len - module_len - 1) == 0 &&
+                tracepoint[len - module_len - 1] == '\0')
+                return 1;
+        }
+
+        entry += len;
+        if (*entry == ',')
+            entry++;
+    }
+
+    return 0;
+}
+
+static void
+hybris_trace_update_sites()
+{
+    struct hybris_tracepoint *tp;
+
+    for (tp = _hybris_tracepoints; tp != NULL; tp = tp->next)
+        tp->state = hybris_trace_filter_match(tp->module, tp->name);
+}
+
+static void
+hybris_trace_signal(int signum)
+{
+    _hybris_should_trace = !_hybris_should_trace;
+    hybris_trace_update_sites();
+}
+
 static void
 hybris_logging_initialize()
 {
@@ -71,6 +131,12 @@ hybris_logging_initialize()
 	if (strcmp(env, "systrace") == 0) {
 		_hybris_logging_format = HYBRIS_LOG_FORMAT_SYSTRACE;
 	}
+	else if (strcmp(env, "ftrace") == 0) {
+		_hybris_logging_format = HYBRIS_LOG_FORMAT_FTRACE;
+	}
+	else if (strcmp(env, "chrome") == 0) {
+		_hybris_logging_format = HYBRIS_LOG_FORMAT_CHROME;
+	}
 	else
 		_hybris_logging_format = HYBRIS_LOG_FORMAT_NORMAL;
     }
@@ -80,8 +146,29 @@ hybris_logging_initialize()
     {
         if (strcmp(env, "1") == 0) {
                _hybris_should_trace = 1;
+        } else if (strcmp(env, "0") != 0 && env[0] != '\0') {
+               _hybris_trace_filter = strdup(env);
+               _hybris_should_trace = 1;
         }
     }
+
+    env = getenv("HYBRIS_TRACE_SIGNAL");
+    if (env != NULL && atoi(env) > 0)
+    {
+        struct sigaction sa;
+
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = hybris_trace_signal;
+        sa.sa_flags = SA_RESTART;
+        sigaction(atoi(env), &sa, NULL);
+    }
+
+    /* trace_marker records the calling thread, it can't be deferred */
+    env = getenv("HYBRIS_LOGGING_ASYNC");
+    if (env != NULL && strcmp(env, "1") == 0 &&
+        _hybris_logging_format != HYBRIS_LOG_FORMAT_FTRACE)
+        _hybris_logging_async = 1;
+
     pthread_mutex_init(&hybris_logging_mutex, NULL);
 }
 
@@ -112,10 +199,109 @@ hybris_get_thread_id()
 int
 hybris_should_trace(const char *module, const char *tracepoint)
 {
-    return _hybris_should_trace;
+    if (!hybris_logging_initialized) {
+        hybris_logging_initialized = 1;
+        hybris_logging_initialize();
+    }
+
+    return hybris_trace_filter_match(module, tracepoint);
+}
+
+void
+hybris_trace_set_enabled(int enabled)
+{
+    if (!hybris_logging_initialized) {
+        hybris_logging_initialized = 1;
+        hybris_logging_initialize();
+    }
+
+    _hybris_should_trace = enabled;
+    __sync_synchronize();
+    hybris_trace_update_sites();
+}
+
+/**
+ * Slow path of the HYBRIS_TRACE_* macros: registers the site on its first
+ * hit, and returns whether it is enabled.
+ **/
+int
+hybris_tracepoint_hit(struct hybris_tracepoint *tp)
+{
+    int state = tp->state;
+
+    if (state == HYBRIS_TRACEPOINT_UNKNOWN) {
+        if (!hybris_logging_initialized) {
+            hybris_logging_initialized = 1;
+            hybris_logging_initialize();
+        }
+
+        if (__sync_bool_compare_and_swap(&tp->registered, 0, 1)) {
+            do {
+                tp->next = _hybris_tracepoints;
+            } while (!__sync_bool_compare_and_swap(&_hybris_tracepoints, tp->next, tp));
+        }
+
+        /* read after publishing the site, so that no toggle can be missed */
+        state = hybris_trace_filter_match(tp->module, tp->name);
+        tp->state = state;
+    }
+
+    return state;
+}
+
+void
+hybris_trace_record(struct hybris_tracepoint *tp, char what, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+
+    if (hybris_logging_async()) {
+        hybris_trace_vasync(what, tp->module, tp->name, format, args);
+        va_end(args);
+        return;
+    }
+
+    if (hybris_logging_format() >= HYBRIS_LOG_FORMAT_FTRACE) {
+        char text[256];
+
+        vsnprintf(text, sizeof(text), format, args);
+        va_end(args);
+        hybris_trace_write(what, tp->module, tp->name, text,
+                           hybris_trace_tid(), hybris_trace_now());
+        return;
+    }
+
+    pthread_mutex_lock(&hybris_logging_mutex);
+    if (hybris_logging_format() == HYBRIS_LOG_FORMAT_NORMAL) {
+        fprintf(hybris_logging_target, "PID: %i Tracepoint-%c/%s::%s",
+                getpid(), what, tp->name, tp->module);
+        vfprintf(hybris_logging_target, format, args);
+        fputc('\n', hybris_logging_target);
+    } else if (hybris_logging_format() == HYBRIS_LOG_FORMAT_SYSTRACE) {
+        if (what == 'B') {
+            fprintf(hybris_logging_target, "B|%i|%s::%s", getpid(), tp->name, tp->module);
+            vfprintf(hybris_logging_target, format, args);
+        } else if (what == 'E') {
+            fprintf(hybris_logging_target, "E");
+        } else {
+            fprintf(hybris_logging_target, "C|%i|%s::%s-%i|",
+                    getpid(), tp->name, tp->module, getpid());
+            vfprintf(hybris_logging_target, format, args);
+        }
+    }
+    fflush(hybris_logging_target);
+    pthread_mutex_unlock(&hybris_logging_mutex);
+
+    va_end(args);
 }
 
 enum hybris_log_format hybris_logging_format()
 {
     return _hybris_logging_format;
 }
+
+int hybris_logging_async()
+{
+    return _hybris_logging_async;
+}
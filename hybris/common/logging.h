@@ -23,6 +23,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <stdarg.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -46,7 +47,11 @@ enum hybris_log_level {
 
 enum hybris_log_format {
     HYBRIS_LOG_FORMAT_NORMAL,
-    HYBRIS_LOG_FORMAT_SYSTRACE
+    HYBRIS_LOG_FORMAT_SYSTRACE,
+
+    /* trace_marker and Chrome JSON, see logging_trace.c */
+    HYBRIS_LOG_FORMAT_FTRACE,
+    HYBRIS_LOG_FORMAT_CHROME
 };
 
 /**
@@ -73,6 +78,53 @@ enum hybris_log_format hybris_logging_format();
 
 int hybris_should_trace(const char *module, const char *tracepoint);
 
+/**
+ * Returns nonzero if HYBRIS_LOGGING_ASYNC=1, in which case messages and
+ * trace records are queued per thread and written by a background thread,
+ * see logging_async.c.
+ **/
+int hybris_logging_async();
+
+void hybris_log_async(const char *level, const char *module, const char *file, int line,
+                      const char *function, const char *format, ...)
+    __attribute__((format(printf, 6, 7)));
+void hybris_trace_vasync(char what, const char *module, const char *tracepoint,
+                         const char *format, va_list args);
+
+/* Writers for the ftrace and chrome formats; what is 'B', 'E' or 'C' for
+ * trace records, 'L' for log messages, with name being the level */
+void hybris_trace_write(char what, const char *module, const char *name, const char *text,
+                        pid_t tid, unsigned long long timestamp);
+void hybris_log_write(const char *level, const char *module, const char *file, int line,
+                      const char *function, const char *format, ...)
+    __attribute__((format(printf, 6, 7)));
+unsigned long long hybris_trace_now(void);
+pid_t hybris_trace_tid(void);
+
+/**
+ * A tracepoint site, statically allocated by the HYBRIS_TRACE_* macros.
+ *
+ * A site registers itself the first time it is hit; after that, it costs
+ * a single branch on "state" while disabled. Tracing is enabled with
+ * HYBRIS_TRACE=1 for all tracepoints, or HYBRIS_TRACE=module[:tracepoint],...
+ * for some of them, and toggled at runtime by hybris_trace_set_enabled() or
+ * by sending the signal given in HYBRIS_TRACE_SIGNAL.
+ **/
+struct hybris_tracepoint {
+    const char *module;
+    const char *name;
+    /* 0 if disabled, 1 if enabled, HYBRIS_TRACEPOINT_UNKNOWN until registered */
+    volatile int state;
+    int registered;
+    struct hybris_tracepoint *next;
+};
+
+#define HYBRIS_TRACEPOINT_UNKNOWN 2
+
+int hybris_tracepoint_hit(struct hybris_tracepoint *tp);
+void hybris_trace_record(struct hybris_tracepoint *tp, char what, const char *format, ...);
+void hybris_trace_set_enabled(int enabled);
+
 extern pthread_mutex_t hybris_logging_mutex;
 
 #ifdef __cplusplus
@@ -83,7 +135,16 @@ extern FILE *hybris_logging_target;
 
 #if defined(DEBUG)
 #    define HYBRIS_LOG_(level, module, message, ...) do { \
-          if (hybris_should_log(level)) { \
+          if (hybris_should_log(level) && hybris_logging_async()) { \
+              hybris_log_async(#level + 11 /* + 11 = strip leading "HYBRIS_LOG_" */, \
+                      module, __FILE__, __LINE__, __PRETTY_FUNCTION__, \
+                      message, ##__VA_ARGS__); \
+          } else if (hybris_should_log(level) && \
+                     hybris_logging_format() >= HYBRIS_LOG_FORMAT_FTRACE) { \
+              hybris_log_write(#level + 11 /* + 11 = strip leading "HYBRIS_LOG_" */, \
+                      module, __FILE__, __LINE__, __PRETTY_FUNCTION__, \
+                      message, ##__VA_ARGS__); \
+          } else if (hybris_should_log(level)) { \
               pthread_mutex_lock(&hybris_logging_mutex); \
               if (hybris_logging_format() == HYBRIS_LOG_FORMAT_NORMAL) \
               { \
@@ -108,39 +169,21 @@ extern FILE *hybris_logging_target;
           } \
      } while(0)
 
-#define HYBRIS_TRACE_RECORD(module, what, tracepoint, message, ...) do { \
-          if (hybris_should_trace(module, tracepoint)) { \
-              pthread_mutex_lock(&hybris_logging_mutex); \
-              if (hybris_logging_format() == HYBRIS_LOG_FORMAT_NORMAL) \
-              { \
-                fprintf(hybris_logging_target, "PID: %i Tracepoint-%c/%s::%s" message "\n", \
-                      getpid(), what, tracepoint, module, \
-                      ##__VA_ARGS__); \
-                fflush(hybris_logging_target); \
-              } else if (hybris_logging_format() == HYBRIS_LOG_FORMAT_SYSTRACE) { \
-                if (what == 'B') \
-                   fprintf(hybris_logging_target, "B|%i|%s::%s" message "", \
-                      getpid(), tracepoint, module, ##__VA_ARGS__); \
-                else if (what == 'E') \
-                   fprintf(hybris_logging_target, "E"); \
-                else \
-                   fprintf(hybris_logging_target, "C|%i|%s::%s-%i|" message "", \
-                      getpid(), tracepoint, module, getpid(), ##__VA_ARGS__); \
-                fflush(hybris_logging_target); \
-              } \
-             pthread_mutex_unlock(&hybris_logging_mutex); \
-          } \
-      } while(0)
-#    define HYBRIS_TRACE_BEGIN(module, tracepoint, message, ...) HYBRIS_TRACE_RECORD(module, 'B', tracepoint, message, ##__VA_ARGS__)
-#    define HYBRIS_TRACE_END(module, tracepoint, message, ...) HYBRIS_TRACE_RECORD(module, 'E', tracepoint, message, ##__VA_ARGS__)
-#    define HYBRIS_TRACE_COUNTER(module, tracepoint, message, ...) HYBRIS_TRACE_RECORD(module, 'C', tracepoint, message, ##__VA_ARGS__)
 #else
 #    define HYBRIS_LOG_(level, module, message, ...) while (0) {}
-#    define HYBRIS_TRACE_BEGIN(module, tracepoint, message, ...) while (0) {}
-#    define HYBRIS_TRACE_END(module, tracepoint, message, ...) while (0) {}
-#    define HYBRIS_TRACE_COUNTER(module, tracepoint, message, ...) while (0) {}
 #endif
 
+/* Tracepoints are compiled in all builds, see struct hybris_tracepoint */
+#define HYBRIS_TRACE_RECORD(module, what, tracepoint, message, ...) do { \
+          static struct hybris_tracepoint _hybris_tp = \
+              { module, tracepoint, HYBRIS_TRACEPOINT_UNKNOWN, 0, NULL }; \
+          if (__builtin_expect(_hybris_tp.state != 0, 0) && hybris_tracepoint_hit(&_hybris_tp)) \
+              hybris_trace_record(&_hybris_tp, what, message, ##__VA_ARGS__); \
+      } while(0)
+#define HYBRIS_TRACE_BEGIN(module, tracepoint, message, ...) HYBRIS_TRACE_RECORD(module, 'B', tracepoint, message, ##__VA_ARGS__)
+#define HYBRIS_TRACE_END(module, tracepoint, message, ...) HYBRIS_TRACE_RECORD(module, 'E', tracepoint, message, ##__VA_ARGS__)
+#define HYBRIS_TRACE_COUNTER(module, tracepoint, message, ...) HYBRIS_TRACE_RECORD(module, 'C', tracepoint, message, ##__VA_ARGS__)
+
 
 /* Generic logging functions taking the module name and a message */
 #define HYBRIS_DEBUG_LOG(module, message, ...) HYBRIS_LOG_(HYBRIS_LOG_DEBUG, #module, message, ##__VA_ARGS__)
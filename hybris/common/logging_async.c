@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Asynchronous logging, enabled with HYBRIS_LOGGING_ASYNC=1.
+ *
+ * Every thread appends fixed size records to its own single producer,
+ * single consumer ring, without locks or system calls. A background thread
+ * merges the rings in timestamp order, formats the records and writes them
+ * out. When a ring is full, new records are dropped and counted; the number
+ * of dropped records is reported in the log itself.
+ *
+ * Only the message arguments are formatted by the thread that logs, into
+ * the record, as %s arguments often point to buffers that are gone by the
+ * time the writer runs. Module, file, function and level are static
+ * strings and are stored as pointers.
+ */
+
+#include "logging.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_RING_SLOTS 256
+#define LOG_TEXT_MAX 200
+#define LOG_WRITER_INTERVAL_NS 10000000
+
+struct log_record {
+    unsigned long long timestamp;
+    const char *module;
+    const char *file;
+    const char *function;
+    /* level name for messages, tracepoint name for trace records */
+    const char *tag;
+    int line;
+    /* 'L' for log messages, 'B', 'E' or 'C' for trace records */
+    char what;
+    char text[LOG_TEXT_MAX];
+};
+
+struct log_ring {
+    /* written by the producer only */
+    volatile unsigned int head;
+    /* written by the writer thread only */
+    volatile unsigned int tail;
+    volatile unsigned long dropped;
+    unsigned long dropped_reported;
+    volatile int exited;
+    pid_t tid;
+    struct log_ring *next;
+    struct log_record records[LOG_RING_SLOTS];
+};
+
+static __thread struct log_ring *_ring = NULL;
+/* set once the ring went to the writer, when the thread exits */
+static __thread int _ring_exited = 0;
+
+static struct log_ring *_rings = NULL;
+static pthread_mutex_t _rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t _writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t _writer_once = PTHREAD_ONCE_INIT;
+static pthread_key_t _ring_key;
+
+static void _write_record(const struct log_ring *ring, const struct log_record *r)
+{
+    FILE *out = hybris_logging_target;
+
+    if (hybris_logging_format() == HYBRIS_LOG_FORMAT_CHROME) {
+        char text[LOG_TEXT_MAX + 256];
+
+        if (r->what == 'L') {
+            snprintf(text, sizeof(text), "%s:%d (%s) %s", r->file, r->line, r->function, r->text);
+            hybris_trace_write('L', r->module, r->tag, text, ring->tid, r->timestamp);
+        } else {
+            hybris_trace_write(r->what, r->module, r->tag, r->text, ring->tid, r->timestamp);
+        }
+        return;
+    }
+
+    if (r->what == 'L') {
+        if (hybris_logging_format() == HYBRIS_LOG_FORMAT_NORMAL) {
+            fprintf(out, "%s %s:%d (%s) %s: %s\n",
+                    r->module, r->file, r->line, r->function, r->tag, r->text);
+        } else if (hybris_logging_format() == HYBRIS_LOG_FORMAT_SYSTRACE) {
+            fprintf(out, "B|%i|%s(%s) %s:%d (%s) %s\n",
+                    getpid(), r->module, r->function, r->file, r->line, r->tag, r->text);
+            fprintf(out, "E|%i|%s(%s) %s:%d (%s) %s\n",
+                    getpid(), r->module, r->function, r->file, r->line, r->tag, r->text);
+        }
+        return;
+    }
+
+    if (hybris_logging_format() == HYBRIS_LOG_FORMAT_NORMAL) {
+        fprintf(out, "PID: %i Tracepoint-%c/%s::%s%s\n",
+                getpid(), r->what, r->tag, r->module, r->text);
+    } else if (hybris_logging_format() == HYBRIS_LOG_FORMAT_SYSTRACE) {
+        if (r->what == 'B')
+            fprintf(out, "B|%i|%s::%s%s", getpid(), r->tag, r->module, r->text);
+        else if (r->what == 'E')
+            fprintf(out, "E");
+        else
+            fprintf(out, "C|%i|%s::%s-%i|%s", getpid(), r->tag, r->module, getpid(), r->text);
+    }
+}
+
+/*
+ * Write out everything queued so far, oldest first across all threads, and
+ * free the rings of threads that are gone.
+ */
+static void _drain(void)
+{
+    struct log_ring *ring, **prev;
+    int written = 0;
+
+    pthread_mutex_lock(&_writer_mutex);
+
+    for (;;) {
+        struct log_ring *oldest = NULL;
+        unsigned long long oldest_ts = 0;
+
+        pthread_mutex_lock(&_rings_mutex);
+        for (ring = _rings; ring != NULL; ring = ring->next) {
+            unsigned int tail = ring->tail;
+            unsigned long long ts;
+
+            if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+                continue;
+
+            ts = ring->records[tail % LOG_RING_SLOTS].timestamp;
+            if (oldest == NULL || ts < oldest_ts) {
+                oldest = ring;
+                oldest_ts = ts;
+            }
+        }
+        pthread_mutex_unlock(&_rings_mutex);
+
+        if (oldest == NULL)
+            break;
+
+        _write_record(oldest, &oldest->records[oldest->tail % LOG_RING_SLOTS]);
+        __atomic_store_n(&oldest->tail, oldest->tail + 1, __ATOMIC_RELEASE);
+        written = 1;
+    }
+
+    pthread_mutex_lock(&_rings_mutex);
+    prev = &_rings;
+    while ((ring = *prev) != NULL) {
+        unsigned long dropped = ring->dropped;
+
+        if (dropped != ring->dropped_reported) {
+            fprintf(hybris_logging_target,
+                    "libhybris: %lu log records of thread %d dropped\n",
+                    dropped - ring->dropped_reported, ring->tid);
+            ring->dropped_reported = dropped;
+            written = 1;
+        }
+
+        if (ring->exited && ring->tail == ring->head) {
+            *prev = ring->next;
+            free(ring);
+        } else {
+            prev = &ring->next;
+        }
+    }
+    pthread_mutex_unlock(&_rings_mutex);
+
+    if (written)
+        fflush(hybris_logging_target);
+
+    pthread_mutex_unlock(&_writer_mutex);
+}
+
+static void *_writer_thread(void *arg)
+{
+    struct timespec interval = { 0, LOG_WRITER_INTERVAL_NS };
+
+    for (;;) {
+        nanosleep(&interval, NULL);
+        _drain();
+    }
+
+    return NULL;
+}
+
+static void _ring_exit(void *data)
+{
+    struct log_ring *ring = data;
+
+    /* the writer frees it once drained, so TLS destructors running after
+     * this one must not touch it, nor register a new ring; their records
+     * are dropped */
+    _ring = NULL;
+    _ring_exited = 1;
+    ring->exited = 1;
+}
+
+static void _writer_start(void)
+{
+    pthread_t thread;
+
+    pthread_key_create(&_ring_key, _ring_exit);
+    atexit(_drain);
+
+    if (pthread_create(&thread, NULL, _writer_thread, NULL) == 0)
+        pthread_detach(thread);
+}
+
+static struct log_ring *_get_ring(void)
+{
+    struct log_ring *ring = _ring;
+
+    if (ring != NULL || _ring_exited)
+        return ring;
+
+    pthread_once(&_writer_once, _writer_start);
+
+    ring = calloc(1, sizeof(*ring));
+    if (ring == NULL)
+        return NULL;
+
+    ring->tid = hybris_trace_tid();
+
+    pthread_mutex_lock(&_rings_mutex);
+    ring->next = _rings;
+    _rings = ring;
+    pthread_mutex_unlock(&_rings_mutex);
+
+    pthread_setspecific(_ring_key, ring);
+    _ring = ring;
+    return ring;
+}
+
+/* returns the slot to fill, or NULL if the record has to be dropped */
+static struct log_record *_reserve(struct log_ring *ring)
+{
+    unsigned int head = ring->head;
+
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SLOTS) {
+        ring->dropped++;
+        return NULL;
+    }
+
+    return &ring->records[head % LOG_RING_SLOTS];
+}
+
+static void _commit(struct log_ring *ring)
+{
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+void
+hybris_log_async(const char *level, const char *module, const char *file, int line,
+                 const char *function, const char *format, ...)
+{
+    struct log_ring *ring = _get_ring();
+    struct log_record *r;
+    va_list args;
+
+    if (ring == NULL || (r = _reserve(ring)) == NULL)
+        return;
+
+    r->timestamp = hybris_trace_now();
+    r->module = module;
+    r->file = file;
+    r->function = function;
+    r->tag = level;
+    r->line = line;
+    r->what = 'L';
+
+    va_start(args, format);
+    vsnprintf(r->text, LOG_TEXT_MAX, format, args);
+    va_end(args);
+
+    _commit(ring);
+}
+
+void
+hybris_trace_vasync(char what, const char *module, const char *tracepoint,
+                    const char *format, va_list args)
+{
+    struct log_ring *ring = _get_ring();
+    struct log_record *r;
+
+    if (ring == NULL || (r = _reserve(ring)) == NULL)
+        return;
+
+    r->timestamp = hybris_trace_now();
+    r->module = module;
+    r->file = NULL;
+    r->function = NULL;
+    r->tag = tracepoint;
+    r->line = 0;
+    r->what = what;
+
+    vsnprintf(r->text, LOG_TEXT_MAX, format, args);
+
+    _commit(ring);
+}
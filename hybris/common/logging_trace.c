@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Trace event writers for HYBRIS_LOGGING_FORMAT=ftrace and =chrome.
+ *
+ * ftrace writes systrace style markers straight to the kernel trace_marker
+ * file, with one write() per event and no locking, so that they show up
+ * next to the scheduler and GPU events of the kernel trace. The kernel
+ * records the writing thread itself, which is why these events are never
+ * deferred to the asynchronous logger.
+ *
+ * chrome writes Chrome trace-event JSON to HYBRIS_LOGGING_TARGET, with
+ * CLOCK_MONOTONIC timestamps in microseconds and thread ids. The closing
+ * "]" is left out, which the trace viewers accept.
+ */
+
+#include "logging.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define TRACE_EVENT_MAX 1024
+
+static const char *_trace_marker_paths[] = {
+    "/sys/kernel/tracing/trace_marker",
+    "/sys/kernel/debug/tracing/trace_marker",
+    NULL
+};
+
+static int _trace_marker_fd = -1;
+static pthread_once_t _trace_once = PTHREAD_ONCE_INIT;
+
+static void _trace_init(void)
+{
+    int i;
+
+    if (hybris_logging_format() == HYBRIS_LOG_FORMAT_FTRACE) {
+        for (i = 0; _trace_marker_paths[i] != NULL && _trace_marker_fd < 0; i++)
+            _trace_marker_fd = open(_trace_marker_paths[i], O_WRONLY | O_CLOEXEC);
+
+        if (_trace_marker_fd < 0)
+            fprintf(hybris_logging_target,
+                    "libhybris: can't open trace_marker, tracing to the log instead\n");
+    } else if (hybris_logging_format() == HYBRIS_LOG_FORMAT_CHROME) {
+        fprintf(hybris_logging_target, "[\n");
+    }
+}
+
+unsigned long long hybris_trace_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+pid_t hybris_trace_tid(void)
+{
+    static __thread pid_t tid = 0;
+
+    if (tid == 0)
+        tid = syscall(SYS_gettid);
+    return tid;
+}
+
+static void _write_marker(char what, const char *module, const char *name, const char *text)
+{
+    char buf[TRACE_EVENT_MAX];
+    int len;
+
+    switch (what) {
+    case 'B':
+        len = snprintf(buf, sizeof(buf), "B|%i|%s::%s%s", getpid(), name, module, text);
+        break;
+    case 'E':
+        len = snprintf(buf, sizeof(buf), "E|%i", getpid());
+        break;
+    case 'C':
+        len = snprintf(buf, sizeof(buf), "C|%i|%s::%s|%s", getpid(), name, module, text);
+        break;
+    default:
+        len = snprintf(buf, sizeof(buf), "%s %s: %s", module, name, text);
+        break;
+    }
+
+    if (len >= (int) sizeof(buf))
+        len = sizeof(buf) - 1;
+
+    if (_trace_marker_fd >= 0) {
+        if (write(_trace_marker_fd, buf, len) < 0) {
+            /* nothing sensible to do about it */
+        }
+    } else {
+        pthread_mutex_lock(&hybris_logging_mutex);
+        fprintf(hybris_logging_target, "%s\n", buf);
+        fflush(hybris_logging_target);
+        pthread_mutex_unlock(&hybris_logging_mutex);
+    }
+}
+
+static void _write_json_string(FILE *out, const char *str)
+{
+    fputc('"', out);
+    for (; *str; str++) {
+        unsigned char c = *str;
+
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+static void _write_json(char what, const char *module, const char *name, const char *text,
+                        pid_t tid, unsigned long long timestamp)
+{
+    FILE *out = hybris_logging_target;
+    char *end;
+
+    pthread_mutex_lock(&hybris_logging_mutex);
+
+    fprintf(out, "{\"ph\":\"%c\",\"pid\":%i,\"tid\":%i,\"ts\":%llu.%03llu",
+            what == 'L' ? 'i' : what, getpid(), tid,
+            timestamp / 1000, timestamp % 1000);
+
+    if (what != 'E') {
+        fprintf(out, ",\"cat\":");
+        _write_json_string(out, module);
+        fprintf(out, ",\"name\":");
+        _write_json_string(out, name);
+    }
+
+    switch (what) {
+    case 'B':
+        if (text[0]) {
+            fprintf(out, ",\"args\":{\"detail\":");
+            _write_json_string(out, text);
+            fputc('}', out);
+        }
+        break;
+    case 'C':
+        /* counters need a number, anything else is kept as a string */
+        fprintf(out, ",\"args\":{");
+        _write_json_string(out, name);
+        fputc(':', out);
+        strtod(text, &end);
+        if (text[0] && *end == '\0')
+            fprintf(out, "%s", text);
+        else
+            _write_json_string(out, text);
+        fputc('}', out);
+        break;
+    case 'L':
+        fprintf(out, ",\"s\":\"t\",\"args\":{\"msg\":");
+        _write_json_string(out, text);
+        fputc('}', out);
+        break;
+    }
+
+    fprintf(out, "},\n");
+    fflush(out);
+
+    pthread_mutex_unlock(&hybris_logging_mutex);
+}
+
+void
+hybris_trace_write(char what, const char *module, const char *name, const char *text,
+                   pid_t tid, unsigned long long timestamp)
+{
+    pthread_once(&_trace_once, _trace_init);
+
+    if (hybris_logging_format() == HYBRIS_LOG_FORMAT_FTRACE)
+        _write_marker(what, module, name, text);
+    else if (hybris_logging_format() == HYBRIS_LOG_FORMAT_CHROME)
+        _write_json(what, module, name, text, tid, timestamp);
+}
+
+void
+hybris_log_write(const char *level, const char *module, const char *file, int line,
+                 const char *function, const char *format, ...)
+{
+    char text[TRACE_EVENT_MAX];
+    va_list args;
+    int len;
+
+    len = snprintf(text, sizeof(text), "%s:%d (%s) ", file, line, function);
+    if (len < 0 || len >= (int) sizeof(text))
+        len = 0;
+
+    va_start(args, format);
+    vsnprintf(text + len, sizeof(text) - len, format, args);
+    va_end(args);
+
+    hybris_trace_write('L', module, level, text, hybris_trace_tid(), hybris_trace_now());
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+/* Debug */
+#include "logging.h"
+#define LOGD(message, ...) HYBRIS_DEBUG_LOG(HYBRIS, message, ##__VA_ARGS__)
+
+static struct hybris_metrics_area *_area = NULL;
+static char _area_path[256];
+static pthread_mutex_t _metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t _metrics_once = PTHREAD_ONCE_INIT;
+
+int hybris_metrics_enabled = 0;
+
+/* where metrics go when there is no area, or it is full */
+static struct hybris_metric _scratch;
+
+static int _open_area_file(void)
+{
+    const char *dir = getenv("HYBRIS_METRICS_DIR");
+    int fd;
+
+    if (dir == NULL)
+        dir = "/dev/shm";
+
+    snprintf(_area_path, sizeof(_area_path), "%s/hybris-metrics.%d", dir, getpid());
+
+    /* never through a planted link, nor into someone else's file */
+    fd = open(_area_path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        /* left behind by a crashed process that had our pid */
+        if (unlink(_area_path) != 0)
+            return -1;
+        fd = open(_area_path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    }
+    if (fd < 0)
+        return -1;
+
+    if (ftruncate(fd, sizeof(struct hybris_metrics_area)) != 0) {
+        close(fd);
+        unlink(_area_path);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void _metrics_exit(void)
+{
+    if (_area != NULL && _area->pid == (uint32_t) getpid())
+        unlink(_area_path);
+}
+
+/*
+ * A forked child gets a file of its own, with the metrics so far, mapped
+ * at the same address so that the pointers cached by metric sites stay
+ * valid.
+ */
+static void _metrics_fork_child(void)
+{
+    void *map;
+    int fd;
+
+    if (_area == NULL)
+        return;
+
+    fd = _open_area_file();
+    if (fd < 0 || write(fd, _area, sizeof(*_area)) != sizeof(*_area)) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(_area_path);
+        }
+        /* keep the parent's mapping away from our updates */
+        map = mmap(_area, sizeof(*_area), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        return;
+    }
+
+    map = mmap(_area, sizeof(*_area), PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_FIXED, fd, 0);
+    close(fd);
+
+    if (map != MAP_FAILED)
+        _area->pid = getpid();
+}
+
+static void _metrics_init(void)
+{
+    FILE *comm;
+    void *map;
+    int fd;
+
+    if (!hybris_metrics_enabled)
+        return;
+
+    fd = _open_area_file();
+    if (fd < 0)
+        goto fail;
+
+    map = mmap(NULL, sizeof(struct hybris_metrics_area), PROT_READ | PROT_WRITE,
+               MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        unlink(_area_path);
+        goto fail;
+    }
+
+    _area = map;
+    _area->pid = getpid();
+    _area->version = HYBRIS_METRICS_VERSION;
+
+    comm = fopen("/proc/self/comm", "r");
+    if (comm != NULL) {
+        if (fgets(_area->comm, sizeof(_area->comm), comm) != NULL)
+            _area->comm[strcspn(_area->comm, "\n")] = '\0';
+        fclose(comm);
+    }
+
+    __sync_synchronize();
+    _area->magic = HYBRIS_METRICS_MAGIC;
+
+    atexit(_metrics_exit);
+    pthread_atfork(NULL, NULL, _metrics_fork_child);
+
+    LOGD("Metrics in %s", _area_path);
+    return;
+
+fail:
+    /* sites that registered already keep updating the scratch metric */
+    hybris_metrics_enabled = 0;
+}
+
+static void __attribute__((constructor)) _hybris_metrics_enable(void)
+{
+    const char *env = getenv("HYBRIS_METRICS");
+
+    hybris_metrics_enabled = env != NULL && strcmp(env, "1") == 0;
+}
+
+struct hybris_metric *hybris_metric_register(const char *name, enum hybris_metric_type type)
+{
+    struct hybris_metric *metric = &_scratch;
+    uint32_t i;
+
+    pthread_once(&_metrics_once, _metrics_init);
+    if (_area == NULL)
+        return metric;
+
+    pthread_mutex_lock(&_metrics_mutex);
+
+    for (i = 0; i < _area->count; i++) {
+        if (strcmp(_area->metrics[i].name, name) == 0) {
+            metric = &_area->metrics[i];
+            goto out;
+        }
+    }
+
+    if (_area->count < HYBRIS_METRICS_MAX) {
+        metric = &_area->metrics[_area->count];
+        strncpy(metric->name, name, HYBRIS_METRIC_NAME_MAX - 1);
+        metric->type = type;
+        /* readers only look at the first count entries */
+        __sync_synchronize();
+        _area->count++;
+    }
+
+out:
+    pthread_mutex_unlock(&_metrics_mutex);
+    return metric;
+}
+
+void hybris_metric_record(struct hybris_metric *metric, uint64_t value)
+{
+    unsigned int bucket = 0;
+
+    if (value > 0) {
+        bucket = 64 - __builtin_clzll(value);
+        if (bucket >= HYBRIS_METRIC_BUCKETS)
+            bucket = HYBRIS_METRIC_BUCKETS - 1;
+    }
+
+    __sync_fetch_and_add(&metric->buckets[bucket], 1);
+    __sync_fetch_and_add(&metric->sum, value);
+    __sync_fetch_and_add(&metric->value, 1);
+}
+
+uint64_t hybris_metric_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// vim:ts=4:sw=4:noexpandtab
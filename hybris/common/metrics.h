@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef HYBRIS_METRICS_H
+#define HYBRIS_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Named counters, gauges and histograms, kept in a per-process shared memory
+ * file, HYBRIS_METRICS_DIR/hybris-metrics.<pid> (/dev/shm by default), for
+ * hybris-top to show live. They are off unless HYBRIS_METRICS=1; the file is
+ * only readable by its owner.
+ *
+ * The file layout below is shared with hybris-top; bump the version when
+ * changing it.
+ */
+
+#define HYBRIS_METRICS_MAGIC 0x4d525948
+#define HYBRIS_METRICS_VERSION 1
+#define HYBRIS_METRICS_MAX 128
+#define HYBRIS_METRIC_NAME_MAX 48
+
+/* bucket 0 counts zeroes, bucket i values in [2^(i-1), 2^i), the last
+ * one everything above */
+#define HYBRIS_METRIC_BUCKETS 24
+
+enum hybris_metric_type {
+    HYBRIS_METRIC_COUNTER = 1,
+    HYBRIS_METRIC_GAUGE,
+    HYBRIS_METRIC_HISTOGRAM,
+};
+
+struct hybris_metric {
+    char name[HYBRIS_METRIC_NAME_MAX];
+    uint32_t type;
+    uint32_t reserved;
+    /* counter total, gauge value, or histogram sample count */
+    volatile uint64_t value;
+    volatile uint64_t sum;
+    volatile uint64_t buckets[HYBRIS_METRIC_BUCKETS];
+};
+
+struct hybris_metrics_area {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pid;
+    volatile uint32_t count;
+    char comm[32];
+    struct hybris_metric metrics[HYBRIS_METRICS_MAX];
+};
+
+/* Set once at load time from HYBRIS_METRICS; every metric site and its
+ * timestamps are behind this one branch, so disabled metrics cost nothing
+ * else. */
+extern int hybris_metrics_enabled;
+
+/* Never returns NULL: when metrics are disabled or full, a scratch metric
+ * nobody reads is returned. Registering a name twice returns the same one. */
+struct hybris_metric *hybris_metric_register(const char *name, enum hybris_metric_type type);
+
+void hybris_metric_record(struct hybris_metric *metric, uint64_t value);
+
+static inline void hybris_metric_add(struct hybris_metric *metric, int64_t delta)
+{
+    __sync_fetch_and_add(&metric->value, delta);
+}
+
+static inline void hybris_metric_set(struct hybris_metric *metric, uint64_t value)
+{
+    __atomic_store_n(&metric->value, value, __ATOMIC_RELAXED);
+}
+
+/* Register on first use, then update: the metric is looked up once per site.
+ * value is not evaluated when metrics are disabled. */
+#define HYBRIS_METRIC_(name, type, op, value) do { \
+        static struct hybris_metric *_hybris_metric = NULL; \
+        if (__builtin_expect(hybris_metrics_enabled, 0)) { \
+            if (__builtin_expect(_hybris_metric == NULL, 0)) \
+                _hybris_metric = hybris_metric_register(name, type); \
+            op(_hybris_metric, value); \
+        } \
+    } while (0)
+
+#define HYBRIS_METRIC_COUNT(name, delta) \
+    HYBRIS_METRIC_(name, HYBRIS_METRIC_COUNTER, hybris_metric_add, delta)
+#define HYBRIS_METRIC_GAUGE(name, value) \
+    HYBRIS_METRIC_(name, HYBRIS_METRIC_GAUGE, hybris_metric_set, value)
+#define HYBRIS_METRIC_RECORD(name, value) \
+    HYBRIS_METRIC_(name, HYBRIS_METRIC_HISTOGRAM, hybris_metric_record, value)
+
+/* Microseconds on CLOCK_MONOTONIC, for timing with HYBRIS_METRIC_RECORD */
+uint64_t hybris_metric_now_us(void);
+
+/* Start of a timed section, 0 without reading the clock when disabled */
+#define HYBRIS_METRIC_START_US() \
+    (__builtin_expect(hybris_metrics_enabled, 0) ? hybris_metric_now_us() : 0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HYBRIS_METRICS_H */
+// vim: noai:ts=4:sw=4:ss=4:expandtab
@@ -0,0 +1,356 @@
+/*
+ * Copyright (c) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Config queries are slow in some Android drivers, with hundreds of configs
+ * and IPC behind each eglGetConfigAttrib(), and toolkits repeat them for
+ * every window. Once a display is initialized, the configs and all their
+ * core attributes are read once, and eglGetConfigs(), eglGetConfigAttrib()
+ * and repeated eglChooseConfig() queries are answered from memory, until
+ * the display is terminated.
+ *
+ * Attributes some config does not have, and the ones outside the core
+ * EGL_BUFFER_SIZE..EGL_CONFORMANT range, like the Android ones, are still
+ * asked from the driver.
+ */
+
+#include "configcache.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "logging.h"
+
+#define ATTRIB_FIRST EGL_BUFFER_SIZE
+#define ATTRIB_LAST EGL_CONFORMANT
+#define ATTRIB_COUNT (ATTRIB_LAST - ATTRIB_FIRST + 1)
+
+/* eglChooseConfig() results kept per display, at most */
+#define MAX_QUERIES 64
+
+struct config_index {
+	EGLConfig config;
+	EGLint index;
+};
+
+struct config_query {
+	struct config_query *next;
+	EGLint *attribs;
+	EGLint attrib_count;
+	EGLConfig *result;
+	EGLint result_count;
+};
+
+struct display_configs {
+	struct display_configs *next;
+	EGLDisplay dpy;
+	EGLint count;
+	/* in the order of the driver */
+	EGLConfig *configs;
+	/* sorted by handle, to find the index of a config */
+	struct config_index *index;
+	/* count rows of ATTRIB_COUNT values */
+	EGLint *values;
+	/* bit n set when attribute ATTRIB_FIRST + n is known for all configs */
+	uint64_t known;
+	struct config_query *queries;
+	int query_count;
+};
+
+static struct display_configs *_displays = NULL;
+static pthread_mutex_t _cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct display_configs *find_display(EGLDisplay dpy)
+{
+	struct display_configs *d;
+
+	for (d = _displays; d != NULL; d = d->next)
+		if (d->dpy == dpy)
+			return d;
+	return NULL;
+}
+
+static void free_display(struct display_configs *d)
+{
+	struct config_query *q, *next;
+
+	for (q = d->queries; q != NULL; q = next) {
+		next = q->next;
+		free(q->attribs);
+		free(q->result);
+		free(q);
+	}
+
+	free(d->configs);
+	free(d->index);
+	free(d->values);
+	free(d);
+}
+
+static int compare_index(const void *a, const void *b)
+{
+	uintptr_t x = (uintptr_t) ((const struct config_index *) a)->config;
+	uintptr_t y = (uintptr_t) ((const struct config_index *) b)->config;
+
+	return x < y ? -1 : x > y;
+}
+
+static int find_config(struct display_configs *d, EGLConfig config)
+{
+	struct config_index key, *found;
+
+	key.config = config;
+	found = bsearch(&key, d->index, d->count, sizeof(*d->index), compare_index);
+	return found != NULL ? found->index : -1;
+}
+
+void egl_config_cache_load(EGLDisplay dpy, egl_get_configs_fn get_configs,
+		egl_get_config_attrib_fn get_config_attrib, egl_get_error_fn get_error)
+{
+	struct display_configs *d;
+	EGLint i, a, count = 0;
+
+	pthread_mutex_lock(&_cache_mutex);
+	d = find_display(dpy);
+	pthread_mutex_unlock(&_cache_mutex);
+
+	/* initializing twice is allowed, and changes nothing */
+	if (d != NULL)
+		return;
+
+	if (get_configs(dpy, NULL, 0, &count) != EGL_TRUE || count <= 0)
+		return;
+
+	d = calloc(1, sizeof(*d));
+	if (d == NULL)
+		return;
+
+	d->dpy = dpy;
+	d->configs = calloc(count, sizeof(EGLConfig));
+	d->index = calloc(count, sizeof(struct config_index));
+	d->values = calloc(count * ATTRIB_COUNT, sizeof(EGLint));
+	if (d->configs == NULL || d->index == NULL || d->values == NULL ||
+	    get_configs(dpy, d->configs, count, &d->count) != EGL_TRUE) {
+		free_display(d);
+		return;
+	}
+
+	d->known = (1ULL << ATTRIB_COUNT) - 1;
+	for (i = 0; i < d->count; i++) {
+		d->index[i].config = d->configs[i];
+		d->index[i].index = i;
+
+		for (a = 0; a < ATTRIB_COUNT; a++) {
+			if (!(d->known & (1ULL << a)))
+				continue;
+			if (get_config_attrib(dpy, d->configs[i], ATTRIB_FIRST + a,
+					&d->values[i * ATTRIB_COUNT + a]) != EGL_TRUE)
+				d->known &= ~(1ULL << a);
+		}
+	}
+
+	/* don't leave EGL_BAD_ATTRIBUTE from the gaps in the range behind */
+	get_error();
+
+	qsort(d->index, d->count, sizeof(*d->index), compare_index);
+
+	pthread_mutex_lock(&_cache_mutex);
+	if (find_display(dpy) == NULL) {
+		d->next = _displays;
+		_displays = d;
+		d = NULL;
+	}
+	pthread_mutex_unlock(&_cache_mutex);
+
+	if (d != NULL)
+		free_display(d);
+	else
+		HYBRIS_DEBUG_LOG(EGL, "cached %d configs of display %p", count, dpy);
+}
+
+void egl_config_cache_drop(EGLDisplay dpy)
+{
+	struct display_configs **d, *found = NULL;
+
+	pthread_mutex_lock(&_cache_mutex);
+	for (d = &_displays; *d != NULL; d = &(*d)->next) {
+		if ((*d)->dpy == dpy) {
+			found = *d;
+			*d = found->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&_cache_mutex);
+
+	if (found != NULL)
+		free_display(found);
+}
+
+EGLBoolean egl_config_cache_get_configs(EGLDisplay dpy, EGLConfig *configs,
+		EGLint config_size, EGLint *num_config)
+{
+	struct display_configs *d;
+
+	if (num_config == NULL)
+		return EGL_FALSE;
+
+	pthread_mutex_lock(&_cache_mutex);
+	d = find_display(dpy);
+	if (d != NULL) {
+		if (configs == NULL) {
+			*num_config = d->count;
+		} else {
+			*num_config = config_size < d->count ? config_size : d->count;
+			if (*num_config > 0)
+				memcpy(configs, d->configs, *num_config * sizeof(EGLConfig));
+			else
+				*num_config = 0;
+		}
+	}
+	pthread_mutex_unlock(&_cache_mutex);
+
+	return d != NULL;
+}
+
+EGLBoolean egl_config_cache_get_attrib(EGLDisplay dpy, EGLConfig config,
+		EGLint attribute, EGLint *value)
+{
+	struct display_configs *d;
+	EGLBoolean found = EGL_FALSE;
+	int a = attribute - ATTRIB_FIRST;
+	int i;
+
+	if (a < 0 || a >= ATTRIB_COUNT || value == NULL)
+		return EGL_FALSE;
+
+	pthread_mutex_lock(&_cache_mutex);
+	d = find_display(dpy);
+	if (d != NULL && (d->known & (1ULL << a))) {
+		i = find_config(d, config);
+		if (i >= 0) {
+			*value = d->values[i * ATTRIB_COUNT + a];
+			found = EGL_TRUE;
+		}
+	}
+	pthread_mutex_unlock(&_cache_mutex);
+
+	return found;
+}
+
+static EGLint attrib_list_length(const EGLint *attrib_list)
+{
+	EGLint n = 0;
+
+	if (attrib_list == NULL)
+		return 0;
+	while (attrib_list[n] != EGL_NONE)
+		n += 2;
+	return n;
+}
+
+/* Answers from a stored query, if there is one; called with the mutex held */
+static int answer_query(struct display_configs *d, const EGLint *attrib_list, EGLint length,
+		EGLConfig *configs, EGLint config_size, EGLint *num_config)
+{
+	struct config_query *q;
+
+	for (q = d->queries; q != NULL; q = q->next) {
+		if (q->attrib_count != length ||
+		    (length > 0 && memcmp(q->attribs, attrib_list, length * sizeof(EGLint)) != 0))
+			continue;
+
+		if (configs == NULL) {
+			*num_config = q->result_count;
+		} else {
+			*num_config = config_size < q->result_count ? config_size : q->result_count;
+			if (*num_config > 0)
+				memcpy(configs, q->result, *num_config * sizeof(EGLConfig));
+			else
+				*num_config = 0;
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+EGLBoolean egl_config_cache_choose(EGLDisplay dpy, const EGLint *attrib_list,
+		EGLConfig *configs, EGLint config_size, EGLint *num_config,
+		egl_choose_config_fn choose_config)
+{
+	EGLint length = attrib_list_length(attrib_list);
+	struct config_query *q;
+	struct display_configs *d;
+	int answered = 0;
+
+	if (num_config == NULL)
+		return choose_config(dpy, attrib_list, configs, config_size, num_config);
+
+	pthread_mutex_lock(&_cache_mutex);
+	d = find_display(dpy);
+	if (d != NULL)
+		answered = answer_query(d, attrib_list, length, configs, config_size, num_config);
+	pthread_mutex_unlock(&_cache_mutex);
+
+	if (d == NULL)
+		return choose_config(dpy, attrib_list, configs, config_size, num_config);
+	if (answered)
+		return EGL_TRUE;
+
+	/* ask for all matches, so that any config_size can be answered later */
+	q = calloc(1, sizeof(*q));
+	if (q == NULL)
+		return choose_config(dpy, attrib_list, configs, config_size, num_config);
+
+	q->attrib_count = length;
+	q->attribs = malloc((length + 1) * sizeof(EGLint));
+	if (q->attribs == NULL ||
+	    choose_config(dpy, attrib_list, NULL, 0, &q->result_count) != EGL_TRUE ||
+	    (q->result = calloc(q->result_count + 1, sizeof(EGLConfig))) == NULL ||
+	    choose_config(dpy, attrib_list, q->result, q->result_count, &q->result_count) != EGL_TRUE) {
+		free(q->attribs);
+		free(q->result);
+		free(q);
+		return choose_config(dpy, attrib_list, configs, config_size, num_config);
+	}
+	if (length > 0)
+		memcpy(q->attribs, attrib_list, length * sizeof(EGLint));
+
+	pthread_mutex_lock(&_cache_mutex);
+	d = find_display(dpy);
+	if (d != NULL && d->query_count < MAX_QUERIES) {
+		q->next = d->queries;
+		d->queries = q;
+		d->query_count++;
+		answer_query(d, attrib_list, length, configs, config_size, num_config);
+		q = NULL;
+	}
+	pthread_mutex_unlock(&_cache_mutex);
+
+	if (q != NULL) {
+		free(q->attribs);
+		free(q->result);
+		free(q);
+		return choose_config(dpy, attrib_list, configs, config_size, num_config);
+	}
+
+	return EGL_TRUE;
+}
+
+// vim:ts=4:sw=4:noexpandtab
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef LIBHYBRIS_EGL_CONFIGCACHE_H
+#define LIBHYBRIS_EGL_CONFIGCACHE_H
+
+#include <EGL/egl.h>
+
+typedef EGLint (*egl_get_error_fn)(void);
+typedef EGLBoolean (*egl_get_configs_fn)(EGLDisplay dpy, EGLConfig *configs,
+		EGLint config_size, EGLint *num_config);
+typedef EGLBoolean (*egl_choose_config_fn)(EGLDisplay dpy, const EGLint *attrib_list,
+		EGLConfig *configs, EGLint config_size, EGLint *num_config);
+typedef EGLBoolean (*egl_get_config_attrib_fn)(EGLDisplay dpy, EGLConfig config,
+		EGLint attribute, EGLint *value);
+
+/* Read all configs of an initialized display and their attributes */
+void egl_config_cache_load(EGLDisplay dpy, egl_get_configs_fn get_configs,
+		egl_get_config_attrib_fn get_config_attrib, egl_get_error_fn get_error);
+
+/* Forget a display, when it is terminated */
+void egl_config_cache_drop(EGLDisplay dpy);
+
+/*
+ * These return EGL_TRUE when the query was answered from the cache, and
+ * EGL_FALSE when it has to go to the driver.
+ */
+EGLBoolean egl_config_cache_get_configs(EGLDisplay dpy, EGLConfig *configs,
+		EGLint config_size, EGLint *num_config);
+EGLBoolean egl_config_cache_get_attrib(EGLDisplay dpy, EGLConfig config,
+		EGLint attribute, EGLint *value);
+
+/* eglChooseConfig(), asking the driver only the first time for a given list */
+EGLBoolean egl_config_cache_choose(EGLDisplay dpy, const EGLint *attrib_list,
+		EGLConfig *configs, EGLint config_size, EGLint *num_config,
+		egl_choose_config_fn choose_config);
+
+#endif /* LIBHYBRIS_EGL_CONFIGCACHE_H */
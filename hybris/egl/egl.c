@@ -25,8 +25,12 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <malloc.h>
+#include <pthread.h>
 #include "ws.h"
 #include "helper.h"
+#include "configcache.h"
+#include "stats.h"
+#include "framestats.h"
 #include <assert.h>
 
 
@@ -35,6 +39,7 @@
 
 #include <android/system/window.h>
 #include "logging.h"
+#include "metrics.h"
 
 static void *_libegl = NULL;
 static void *_libgles = NULL;
@@ -114,65 +119,145 @@ static void (*_glEGLImageTargetTexture2DOES) (GLenum target, GLeglImageOES image
 
 static __eglMustCastToProperFunctionPointerType (*_eglGetProcAddress)(const char *procname) = NULL;
 
-static void _init_androidegl()
-{
-	_libegl = (void *) android_dlopen(getenv("LIBEGL") ? getenv("LIBEGL") : "libEGL.so", RTLD_LAZY);
-	_libgles = (void *) android_dlopen(getenv("LIBGLESV2") ? getenv("LIBGLESV2") : "libGLESv2.so", RTLD_LAZY);
-}
+/*
+ * All entry points are resolved together, once, so that each wrapper is a
+ * pthread_once() check and an indirect call, and threads making their first
+ * EGL calls concurrently can't race on loading the driver. With
+ * HYBRIS_EGL_PRELOAD=1 this happens when the library is loaded rather than
+ * on the first EGL call, which is usually on the way to the first frame.
+ */
+#define EGL_SYMBOL(name) { (void **) &_##name, #name }
+
+static const struct {
+	void **fptr;
+	const char *sym;
+} _egl_symbols[] = {
+	EGL_SYMBOL(eglGetError),
+	EGL_SYMBOL(eglGetDisplay),
+	EGL_SYMBOL(eglInitialize),
+	EGL_SYMBOL(eglTerminate),
+	EGL_SYMBOL(eglQueryString),
+	EGL_SYMBOL(eglGetConfigs),
+	EGL_SYMBOL(eglChooseConfig),
+	EGL_SYMBOL(eglGetConfigAttrib),
+	EGL_SYMBOL(eglCreateWindowSurface),
+	EGL_SYMBOL(eglCreatePbufferSurface),
+	EGL_SYMBOL(eglCreatePixmapSurface),
+	EGL_SYMBOL(eglDestroySurface),
+	EGL_SYMBOL(eglQuerySurface),
+	EGL_SYMBOL(eglBindAPI),
+	EGL_SYMBOL(eglQueryAPI),
+	EGL_SYMBOL(eglWaitClient),
+	EGL_SYMBOL(eglReleaseThread),
+	EGL_SYMBOL(eglCreatePbufferFromClientBuffer),
+	EGL_SYMBOL(eglSurfaceAttrib),
+	EGL_SYMBOL(eglBindTexImage),
+	EGL_SYMBOL(eglReleaseTexImage),
+	EGL_SYMBOL(eglSwapInterval),
+	EGL_SYMBOL(eglCreateContext),
+	EGL_SYMBOL(eglDestroyContext),
+	EGL_SYMBOL(eglMakeCurrent),
+	EGL_SYMBOL(eglGetCurrentContext),
+	EGL_SYMBOL(eglGetCurrentSurface),
+	EGL_SYMBOL(eglGetCurrentDisplay),
+	EGL_SYMBOL(eglQueryContext),
+	EGL_SYMBOL(eglWaitGL),
+	EGL_SYMBOL(eglWaitNative),
+	EGL_SYMBOL(eglSwapBuffers),
+	EGL_SYMBOL(eglCopyBuffers),
+	EGL_SYMBOL(eglCreateImageKHR),
+	EGL_SYMBOL(eglGetProcAddress),
+	EGL_SYMBOL(eglDestroyImageKHR),
+	{ NULL, NULL }
+};
 
-#define EGL_DLSYM(fptr, sym) do { if (_libegl == NULL) { _init_androidegl(); }; if (*(fptr) == NULL) { *(fptr) = (void *) android_dlsym(_libegl, sym); } } while (0) 
-#define GLESv2_DLSYM(fptr, sym) do { if (_libgles == NULL) { _init_androidegl(); }; if (*(fptr) == NULL) { *(fptr) = (void *) android_dlsym(_libgles, sym); } } while (0) 
+static pthread_once_t _androidegl_once = PTHREAD_ONCE_INIT;
 
-EGLint eglGetError(void)
-{
-	EGL_DLSYM(&_eglGetError, "eglGetError");
-	return (*_eglGetError)();
-}
-
-struct _eglDisplayMapping {
-	EGLNativeDisplayType ndt;
+/*
+ * The binding of the calling thread, as set by the last successful
+ * eglMakeCurrent() or eglReleaseThread() through us, so that the
+ * eglGetCurrent*() getters, which toolkits call a lot, don't have to go into
+ * the driver, and so that eglMakeCurrent() calls that change nothing can be
+ * skipped. Until the thread binds through us, the driver is asked.
+ *
+ * This is off unless HYBRIS_EGL_CURRENT_CACHE=1: Android libraries loaded
+ * by the driver call its eglMakeCurrent() directly, behind our back, and
+ * a skipped rebind also skips the flush the driver does on it, so it only
+ * suits applications known to do neither.
+ */
+struct _eglCurrent {
+	int known;
 	EGLDisplay display;
+	EGLSurface draw;
+	EGLSurface read;
+	EGLContext context;
 };
 
-#define _EGL_MAX_DISPLAYS 100
+static __thread struct _eglCurrent _current;
+static int _current_cache = 0;
 
-struct _eglDisplayMapping *_displayMappings[_EGL_MAX_DISPLAYS];
+/* HYBRIS_EGL_CONFIG_CACHE=0 turns off the config cache in configcache.c */
+static int _config_cache = 1;
 
-void _addMapping(EGLNativeDisplayType display_id, EGLDisplay display)
+static void _set_current(EGLDisplay dpy, EGLSurface draw, EGLSurface read, EGLContext ctx)
 {
-	int i;
-	for (i = 0; i < _EGL_MAX_DISPLAYS; i++)
-	{
-		if (_displayMappings[i] == NULL)
-		{
-			_displayMappings[i] = (struct _eglDisplayMapping *) malloc(sizeof(struct _eglDisplayMapping));
-			_displayMappings[i]->ndt = display_id;
-			_displayMappings[i]->display = display;
-			return;
-		}
+	if (!_current_cache)
+		return;
+
+	if (ctx == EGL_NO_CONTEXT) {
+		dpy = EGL_NO_DISPLAY;
+		draw = read = EGL_NO_SURFACE;
 	}
+
+	_current.display = dpy;
+	_current.draw = draw;
+	_current.read = read;
+	_current.context = ctx;
+	_current.known = 1;
 }
 
-EGLNativeDisplayType _egldisplay2NDT(EGLDisplay display)
+static void _init_androidegl()
 {
+	const char *env = getenv("HYBRIS_EGL_CURRENT_CACHE");
 	int i;
-	for (i = 0; i < _EGL_MAX_DISPLAYS; i++)
-	{
-		if (_displayMappings[i])
-		{
-			if (_displayMappings[i]->display == display)
-			{
-				return _displayMappings[i]->ndt;
-			}
 
-		}
-	}
-	return EGL_NO_DISPLAY;
+	if (env != NULL && strcmp(env, "1") == 0)
+		_current_cache = 1;
+
+	env = getenv("HYBRIS_EGL_CONFIG_CACHE");
+	if (env != NULL && strcmp(env, "0") == 0)
+		_config_cache = 0;
+
+	_libegl = (void *) android_dlopen(getenv("LIBEGL") ? getenv("LIBEGL") : "libEGL.so", RTLD_LAZY);
+	_libgles = (void *) android_dlopen(getenv("LIBGLESV2") ? getenv("LIBGLESV2") : "libGLESv2.so", RTLD_LAZY);
+
+	for (i = 0; _egl_symbols[i].fptr != NULL; i++)
+		*_egl_symbols[i].fptr = (void *) android_dlsym(_libegl, _egl_symbols[i].sym);
+
+	_glEGLImageTargetTexture2DOES = (void *) android_dlsym(_libgles, "glEGLImageTargetTexture2DOES");
+}
+
+#define EGL_INIT() pthread_once(&_androidegl_once, _init_androidegl)
+
+static void __attribute__((constructor)) _egl_preload(void)
+{
+	const char *env = getenv("HYBRIS_EGL_PRELOAD");
+
+	if (env != NULL && strcmp(env, "1") == 0)
+		EGL_INIT();
+}
+
+EGLint eglGetError(void)
+{
+	EGL_STAT(eglGetError);
+	EGL_INIT();
+	return (*_eglGetError)();
 }
 
 EGLDisplay eglGetDisplay(EGLNativeDisplayType display_id)
 {
-	EGL_DLSYM(&_eglGetDisplay, "eglGetDisplay");
+	EGL_STAT(eglGetDisplay);
+	EGL_INIT();
 	EGLNativeDisplayType real_display;
 
 	if (!ws_IsValidDisplay(display_id))
@@ -185,32 +270,47 @@ EGLDisplay eglGetDisplay(EGLNativeDisplayType display_id)
 	{
 		return EGL_NO_DISPLAY;
 	}
-	_addMapping(display_id, real_display);
+	egl_helper_add_display(real_display, display_id);
 	return real_display;
 }
 
 EGLBoolean eglInitialize(EGLDisplay dpy, EGLint *major, EGLint *minor)
 {
-	EGL_DLSYM(&_eglInitialize, "eglInitialize");
-	return (*_eglInitialize)(dpy, major, minor);
+	EGL_STAT(eglInitialize);
+	EGLBoolean result;
+
+	EGL_INIT();
+	result = (*_eglInitialize)(dpy, major, minor);
+	if (result == EGL_TRUE && _config_cache)
+		egl_config_cache_load(dpy, _eglGetConfigs, _eglGetConfigAttrib, _eglGetError);
+	return result;
 }
 
 EGLBoolean eglTerminate(EGLDisplay dpy)
 {
-	EGL_DLSYM(&_eglTerminate, "eglTerminate");
+	EGL_STAT(eglTerminate);
+	EGL_INIT();
+	if (_current.known && _current.display == dpy)
+		_current.known = 0;
+	egl_config_cache_drop(dpy);
+	egl_stats_report(stderr);
 	return (*_eglTerminate)(dpy);
 }
 
 const char * eglQueryString(EGLDisplay dpy, EGLint name)
 {
-	EGL_DLSYM(&_eglQueryString, "eglQueryString");
+	EGL_STAT(eglQueryString);
+	EGL_INIT();
 	return ws_eglQueryString(dpy, name, _eglQueryString);
 }
 
 EGLBoolean eglGetConfigs(EGLDisplay dpy, EGLConfig *configs,
 		EGLint config_size, EGLint *num_config)
 {
-	EGL_DLSYM(&_eglGetConfigs, "eglGetConfigs");
+	EGL_STAT(eglGetConfigs);
+	EGL_INIT();
+	if (egl_config_cache_get_configs(dpy, configs, config_size, num_config))
+		return EGL_TRUE;
 	return (*_eglGetConfigs)(dpy, configs, config_size, num_config);
 }
 
@@ -218,7 +318,12 @@ EGLBoolean eglChooseConfig(EGLDisplay dpy, const EGLint *attrib_list,
 		EGLConfig *configs, EGLint config_size,
 		EGLint *num_config)
 {
-	EGL_DLSYM(&_eglChooseConfig, "eglChooseConfig");
+	EGL_STAT(eglChooseConfig);
+	EGL_INIT();
+	if (_config_cache)
+		return egl_config_cache_choose(dpy, attrib_list,
+				configs, config_size,
+				num_config, _eglChooseConfig);
 	return (*_eglChooseConfig)(dpy, attrib_list,
 			configs, config_size,
 			num_config);
@@ -227,7 +332,10 @@ EGLBoolean eglChooseConfig(EGLDisplay dpy, const EGLint *attrib_list,
 EGLBoolean eglGetConfigAttrib(EGLDisplay dpy, EGLConfig config,
 		EGLint attribute, EGLint *value)
 {
-	EGL_DLSYM(&_eglGetConfigAttrib, "eglGetConfigAttrib");
+	EGL_STAT(eglGetConfigAttrib);
+	EGL_INIT();
+	if (egl_config_cache_get_attrib(dpy, config, attribute, value))
+		return EGL_TRUE;
 	return (*_eglGetConfigAttrib)(dpy, config,
 			attribute, value);
 }
@@ -236,21 +344,24 @@ EGLSurface eglCreateWindowSurface(EGLDisplay dpy, EGLConfig config,
 		EGLNativeWindowType win,
 		const EGLint *attrib_list)
 {
-	EGL_DLSYM(&_eglCreateWindowSurface, "eglCreateWindowSurface");
+	EGL_STAT(eglCreateWindowSurface);
+	EGL_INIT();
 
-	win = ws_CreateWindow(win,  _egldisplay2NDT(dpy));
+	win = ws_CreateWindow(win,  egl_helper_display_ndt(dpy));
 	
 	assert(((struct ANativeWindowBuffer *) win)->common.magic == ANDROID_NATIVE_WINDOW_MAGIC);
 
 	EGLSurface result = (*_eglCreateWindowSurface)(dpy, config, win, attrib_list);
 	egl_helper_push_mapping(result, win);
+	egl_frame_stats_add(result, win);
 	return result;
 }
 
 EGLSurface eglCreatePbufferSurface(EGLDisplay dpy, EGLConfig config,
 		const EGLint *attrib_list)
 {
-	EGL_DLSYM(&_eglCreatePbufferSurface, "eglCreatePbufferSurface");
+	EGL_STAT(eglCreatePbufferSurface);
+	EGL_INIT();
 	return (*_eglCreatePbufferSurface)(dpy, config, attrib_list);
 }
 
@@ -258,88 +369,124 @@ EGLSurface eglCreatePixmapSurface(EGLDisplay dpy, EGLConfig config,
 		EGLNativePixmapType pixmap,
 		const EGLint *attrib_list)
 {
-	EGL_DLSYM(&_eglCreatePixmapSurface, "eglCreatePixmapSurface");
+	EGL_STAT(eglCreatePixmapSurface);
+	EGL_INIT();
 	return (*_eglCreatePixmapSurface)(dpy, config, pixmap, attrib_list);
 }
 
 EGLBoolean eglDestroySurface(EGLDisplay dpy, EGLSurface surface)
 {
-	EGL_DLSYM(&_eglDestroySurface, "eglDestroySurface");
+	EGL_STAT(eglDestroySurface);
+	EGL_INIT();
 	EGLBoolean result = (*_eglDestroySurface)(dpy, surface);
 
+	if (_current.known && (_current.draw == surface || _current.read == surface))
+		_current.known = 0;
+
 	/**
          * If the surface was created via eglCreateWindowSurface, we must
          * notify the ws about surface destruction for clean-up.
 	 **/
 	if (egl_helper_has_mapping(surface)) {
+	    egl_frame_stats_remove(surface);
 	    ws_DestroyWindow(egl_helper_pop_mapping(surface));
 	}
 
 	return result;
 }
 
+/* whether ext is one of the extensions the driver itself lists */
+static int _driver_has_extension(EGLDisplay dpy, const char *ext)
+{
+	const char *exts = (*_eglQueryString)(dpy, EGL_EXTENSIONS);
+	const char *found = exts;
+	size_t len = strlen(ext);
+
+	while (found != NULL && (found = strstr(found, ext)) != NULL) {
+		if ((found == exts || found[-1] == ' ') &&
+		    (found[len] == ' ' || found[len] == '\0'))
+			return 1;
+		found += len;
+	}
+
+	return 0;
+}
+
 EGLBoolean eglQuerySurface(EGLDisplay dpy, EGLSurface surface,
 		EGLint attribute, EGLint *value)
 {
-	EGL_DLSYM(&_eglQuerySurface, "eglQuerySurface");
+	EGL_STAT(eglQuerySurface);
+	EGL_INIT();
 	return (*_eglQuerySurface)(dpy, surface, attribute, value);
 }
 
 
 EGLBoolean eglBindAPI(EGLenum api)
 {
-	EGL_DLSYM(&_eglBindAPI, "eglBindAPI");
+	EGL_STAT(eglBindAPI);
+	EGL_INIT();
 	return (*_eglBindAPI)(api);
 }
 
 EGLenum eglQueryAPI(void)
 {
-	EGL_DLSYM(&_eglQueryAPI, "eglQueryAPI");
+	EGL_STAT(eglQueryAPI);
+	EGL_INIT();
 	return (*_eglQueryAPI)();
 }
 
 EGLBoolean eglWaitClient(void)
 {
-	EGL_DLSYM(&_eglWaitClient, "eglWaitClient");
+	EGL_STAT(eglWaitClient);
+	EGL_INIT();
 	return (*_eglWaitClient)();
 }
 
 EGLBoolean eglReleaseThread(void)
 {
-	EGL_DLSYM(&_eglReleaseThread, "eglReleaseThread");
-	return (*_eglReleaseThread)();
+	EGL_STAT(eglReleaseThread);
+	EGL_INIT();
+	EGLBoolean result = (*_eglReleaseThread)();
+	if (result == EGL_TRUE)
+		_set_current(EGL_NO_DISPLAY, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	return result;
 }
 
 EGLSurface eglCreatePbufferFromClientBuffer(
 		EGLDisplay dpy, EGLenum buftype, EGLClientBuffer buffer,
 		EGLConfig config, const EGLint *attrib_list)
 {
-	EGL_DLSYM(&_eglCreatePbufferFromClientBuffer, "eglCreatePbufferFromClientBuffer");
+	EGL_STAT(eglCreatePbufferFromClientBuffer);
+	EGL_INIT();
 	return (*_eglCreatePbufferFromClientBuffer)(dpy, buftype, buffer, config, attrib_list);
 }
 
 EGLBoolean eglSurfaceAttrib(EGLDisplay dpy, EGLSurface surface,
 		EGLint attribute, EGLint value)
 {
-	EGL_DLSYM(&_eglSurfaceAttrib, "eglSurfaceAttrib");
+	EGL_STAT(eglSurfaceAttrib);
+	EGL_INIT();
 	return (*_eglSurfaceAttrib)(dpy, surface, attribute, value);
 }
 
 EGLBoolean eglBindTexImage(EGLDisplay dpy, EGLSurface surface, EGLint buffer)
 {
-	EGL_DLSYM(&_eglBindTexImage, "eglBindTexImage");
+	EGL_STAT(eglBindTexImage);
+	EGL_INIT();
 	return (*_eglBindTexImage)(dpy, surface, buffer);
 }
 
 EGLBoolean eglReleaseTexImage(EGLDisplay dpy, EGLSurface surface, EGLint buffer)
 {
-	EGL_DLSYM(&_eglReleaseTexImage, "eglReleaseTexImage");
+	EGL_STAT(eglReleaseTexImage);
+	EGL_INIT();
 	return (*_eglReleaseTexImage)(dpy, surface, buffer);
 }
 
 EGLBoolean eglSwapInterval(EGLDisplay dpy, EGLint interval)
 {
-	EGL_DLSYM(&_eglSwapInterval, "eglSwapInterval");
+	EGL_STAT(eglSwapInterval);
+	EGL_INIT();
 	return (*_eglSwapInterval)(dpy, interval);
 }
 
@@ -347,80 +494,143 @@ EGLContext eglCreateContext(EGLDisplay dpy, EGLConfig config,
 		EGLContext share_context,
 		const EGLint *attrib_list)
 {
-	EGL_DLSYM(&_eglCreateContext, "eglCreateContext");
+	EGL_STAT(eglCreateContext);
+	EGL_INIT();
 	return (*_eglCreateContext)(dpy, config, share_context, attrib_list);
 }
 
 EGLBoolean eglDestroyContext(EGLDisplay dpy, EGLContext ctx)
 {
-	EGL_DLSYM(&_eglDestroyContext, "eglDestroyContext");
+	EGL_STAT(eglDestroyContext);
+	EGL_INIT();
+	if (_current.known && _current.context == ctx)
+		_current.known = 0;
 	return (*_eglDestroyContext)(dpy, ctx);
 }
 
 EGLBoolean eglMakeCurrent(EGLDisplay dpy, EGLSurface draw,
 		EGLSurface read, EGLContext ctx)
 {
-	EGL_DLSYM(&_eglMakeCurrent, "eglMakeCurrent");
-	return (*_eglMakeCurrent)(dpy, draw, read, ctx);
+	EGL_STAT(eglMakeCurrent);
+	EGLBoolean result;
+
+	EGL_INIT();
+
+	if (_current.known && _current.display == dpy && _current.draw == draw &&
+	    _current.read == read && _current.context == ctx && ctx != EGL_NO_CONTEXT) {
+		HYBRIS_METRIC_COUNT("egl.make_current_elided", 1);
+		return EGL_TRUE;
+	}
+
+	result = (*_eglMakeCurrent)(dpy, draw, read, ctx);
+	if (result == EGL_TRUE)
+		_set_current(dpy, draw, read, ctx);
+	return result;
 }
 
 EGLContext eglGetCurrentContext(void)
 {
-	EGL_DLSYM(&_eglGetCurrentContext, "eglGetCurrentContext");
+	EGL_STAT(eglGetCurrentContext);
+	if (_current.known)
+		return _current.context;
+
+	EGL_INIT();
 	return (*_eglGetCurrentContext)();
 }
 
 EGLSurface eglGetCurrentSurface(EGLint readdraw)
 {
-	EGL_DLSYM(&_eglGetCurrentSurface, "eglGetCurrentSurface");
+	EGL_STAT(eglGetCurrentSurface);
+	if (_current.known) {
+		if (readdraw == EGL_DRAW)
+			return _current.draw;
+		if (readdraw == EGL_READ)
+			return _current.read;
+	}
+
+	EGL_INIT();
 	return (*_eglGetCurrentSurface)(readdraw);
 }
 
 EGLDisplay eglGetCurrentDisplay(void)
 {
-	EGL_DLSYM(&_eglGetCurrentDisplay, "eglGetCurrentDisplay");
+	EGL_STAT(eglGetCurrentDisplay);
+	if (_current.known)
+		return _current.display;
+
+	EGL_INIT();
 	return (*_eglGetCurrentDisplay)();
 }
 
 EGLBoolean eglQueryContext(EGLDisplay dpy, EGLContext ctx,
 		EGLint attribute, EGLint *value)
 {
-	EGL_DLSYM(&_eglQueryContext, "eglQueryContext");
+	EGL_STAT(eglQueryContext);
+	EGL_INIT();
 	return (*_eglQueryContext)(dpy, ctx, attribute, value);
 }
 
 EGLBoolean eglWaitGL(void)
 {
-	EGL_DLSYM(&_eglWaitGL, "eglWaitGL");
+	EGL_STAT(eglWaitGL);
+	EGL_INIT();
 	return (*_eglWaitGL)();
 }
 
 EGLBoolean eglWaitNative(EGLint engine)
 {
-	EGL_DLSYM(&_eglWaitNative, "eglWaitNative");
+	EGL_STAT(eglWaitNative);
+	EGL_INIT();
 	return (*_eglWaitNative)(engine); 
 }
 
-EGLBoolean eglSwapBuffers(EGLDisplay dpy, EGLSurface surface)
+typedef EGLBoolean (*_swapWithDamage)(EGLDisplay dpy, EGLSurface surface,
+		EGLint *rects, EGLint n_rects);
+
+/*
+ * The swap itself, with the frame statistics, for both ways to swap. With
+ * swap_damage, the driver's own swap with damage is used.
+ */
+static EGLBoolean _swap_buffers(EGLDisplay dpy, EGLSurface surface,
+		_swapWithDamage swap_damage, EGLint *rects, EGLint n_rects)
 {
 	EGLBoolean ret; 
+	uint64_t start = HYBRIS_METRIC_START_US();
+	unsigned long long frame_start = 0;
 	HYBRIS_TRACE_BEGIN("hybris-egl", "eglSwapBuffers", "");
-	EGL_DLSYM(&_eglSwapBuffers, "eglSwapBuffers");
-	ret = (*_eglSwapBuffers)(dpy, surface);
+	EGL_INIT();
+	if (egl_frame_stats_enabled)
+		frame_start = egl_frame_stats_begin(surface);
+	if (swap_damage != NULL)
+		ret = (*swap_damage)(dpy, surface, rects, n_rects);
+	else
+		ret = (*_eglSwapBuffers)(dpy, surface);
+	if (frame_start != 0)
+		egl_frame_stats_end(surface, frame_start);
 	HYBRIS_TRACE_END("hybris-egl", "eglSwapBuffers", "");
+	HYBRIS_METRIC_COUNT("egl.frames", 1);
+	HYBRIS_METRIC_RECORD("egl.swap_us", hybris_metric_now_us() - start);
 	return ret;
 }
 
+EGLBoolean eglSwapBuffers(EGLDisplay dpy, EGLSurface surface)
+{
+	EGL_STAT(eglSwapBuffers);
+	return _swap_buffers(dpy, surface, NULL, NULL, 0);
+}
+
 EGLBoolean eglCopyBuffers(EGLDisplay dpy, EGLSurface surface,
 		EGLNativePixmapType target)
 {
-	EGL_DLSYM(&_eglCopyBuffers, "eglCopyBuffers");
+	EGL_STAT(eglCopyBuffers);
+	EGL_INIT();
 	return (*_eglCopyBuffers)(dpy, surface, target);
 }
 
 static EGLImageKHR _my_eglCreateImageKHR(EGLDisplay dpy, EGLContext ctx, EGLenum target, EGLClientBuffer buffer, const EGLint *attrib_list)
 {
-	EGL_DLSYM(&_eglCreateImageKHR, "eglCreateImageKHR");
+	EGL_STAT(eglCreateImageKHR);
+	EGL_INIT();
 	EGLContext newctx = ctx;
 	EGLenum newtarget = target;
 	EGLClientBuffer newbuffer = buffer;
@@ -432,21 +642,163 @@ static EGLImageKHR _my_eglCreateImageKHR(EGLDisplay dpy, EGLContext ctx, EGLenum
 
 static void _my_glEGLImageTargetTexture2DOES(GLenum target, GLeglImageOES image)
 {
-	GLESv2_DLSYM(&_glEGLImageTargetTexture2DOES, "glEGLImageTargetTexture2DOES");
+	EGL_STAT(glEGLImageTargetTexture2DOES);
+	EGL_INIT();
 	(*_glEGLImageTargetTexture2DOES)(target, image);
 	return;
 }
 
-__eglMustCastToProperFunctionPointerType eglGetProcAddress(const char *procname)
+/* the driver's own eglSwapBuffersWithDamage{KHR,EXT}(), if it has one */
+static _swapWithDamage _driver_swap_with_damage(EGLDisplay dpy)
+{
+	static int resolved = 0;
+	static _swapWithDamage proc = NULL;
+
+	if (!__atomic_load_n(&resolved, __ATOMIC_ACQUIRE)) {
+		_swapWithDamage found = NULL;
+
+		if (_driver_has_extension(dpy, "EGL_KHR_swap_buffers_with_damage"))
+			found = (_swapWithDamage) (*_eglGetProcAddress)("eglSwapBuffersWithDamageKHR");
+		else if (_driver_has_extension(dpy, "EGL_EXT_swap_buffers_with_damage"))
+			found = (_swapWithDamage) (*_eglGetProcAddress)("eglSwapBuffersWithDamageEXT");
+
+		__atomic_store_n(&proc, found, __ATOMIC_RELAXED);
+		__atomic_store_n(&resolved, 1, __ATOMIC_RELEASE);
+	}
+
+	return __atomic_load_n(&proc, __ATOMIC_RELAXED);
+}
+
+/*
+ * EGL_KHR_swap_buffers_with_damage: the damage is handed to the window for
+ * the buffer being drawn, which the driver queues from within the swap.
+ * Drivers that have the extension themselves get the damage too.
+ */
+static EGLBoolean _my_eglSwapBuffersWithDamageKHR(EGLDisplay dpy, EGLSurface surface,
+		EGLint *rects, EGLint n_rects)
+{
+	EGL_STAT(eglSwapBuffersWithDamageKHR);
+	EGL_INIT();
+	struct ANativeWindow *win = (struct ANativeWindow *) egl_helper_get_mapping(surface);
+	EGLBoolean ret;
+
+	if (win != NULL && n_rects > 0 && rects != NULL)
+		win->perform(win, NATIVE_WINDOW_HYBRIS_SET_SURFACE_DAMAGE, rects, n_rects);
+
+	ret = _swap_buffers(dpy, surface, _driver_swap_with_damage(dpy), rects, n_rects);
+
+	/* don't leave the damage to the next eglSwapBuffers() */
+	if (ret != EGL_TRUE && win != NULL && n_rects > 0 && rects != NULL)
+		win->perform(win, NATIVE_WINDOW_HYBRIS_SET_SURFACE_DAMAGE, NULL, 0);
+
+	return ret;
+}
+
+/*
+ * eglGetProcAddress() results, including NULL ones, keyed by name. Toolkits
+ * resolve hundreds of names at startup, some of them again for each
+ * context, and each miss goes through the platform's and the driver's
+ * lookups. Entries are never removed, and are published complete, so
+ * lookups take no lock; only adding one does.
+ * HYBRIS_EGL_PROC_CACHE=0 turns this off.
+ */
+#define PROC_CACHE_BUCKETS 512
+
+struct _procEntry {
+	struct _procEntry *next;
+	__eglMustCastToProperFunctionPointerType proc;
+	char name[];
+};
+
+static struct _procEntry *_proc_cache[PROC_CACHE_BUCKETS];
+static pthread_mutex_t _proc_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t _proc_cache_once = PTHREAD_ONCE_INIT;
+static int _proc_cache_enabled = 1;
+
+static unsigned int _proc_hash(const char *name)
+{
+	unsigned int hash = 2166136261u;
+
+	while (*name)
+		hash = (hash ^ (unsigned char) *name++) * 16777619u;
+	return hash % PROC_CACHE_BUCKETS;
+}
+
+static struct _procEntry *_proc_cache_find(const char *name, unsigned int hash)
+{
+	struct _procEntry *entry;
+
+	for (entry = __atomic_load_n(&_proc_cache[hash], __ATOMIC_ACQUIRE);
+	     entry != NULL; entry = entry->next)
+		if (strcmp(entry->name, name) == 0)
+			return entry;
+	return NULL;
+}
+
+static void _proc_cache_add(const char *name, __eglMustCastToProperFunctionPointerType proc)
+{
+	unsigned int hash = _proc_hash(name);
+	struct _procEntry *entry;
+
+	pthread_mutex_lock(&_proc_cache_mutex);
+
+	/* another thread may have resolved it meanwhile */
+	if (_proc_cache_find(name, hash) == NULL) {
+		entry = malloc(sizeof(*entry) + strlen(name) + 1);
+		if (entry != NULL) {
+			strcpy(entry->name, name);
+			entry->proc = proc;
+			entry->next = _proc_cache[hash];
+			__atomic_store_n(&_proc_cache[hash], entry, __ATOMIC_RELEASE);
+		}
+	}
+
+	pthread_mutex_unlock(&_proc_cache_mutex);
+}
+
+static EGLBoolean _my_eglHybrisQueryFrameStats(EGLDisplay dpy, EGLSurface surface,
+		EGLFrameStatsHYBRIS *stats)
+{
+	return egl_frame_stats_query(dpy, surface, stats);
+}
+
+static void _proc_cache_init(void)
+{
+	const char *env = getenv("HYBRIS_EGL_PROC_CACHE");
+
+	if (env != NULL && strcmp(env, "0") == 0) {
+		_proc_cache_enabled = 0;
+		return;
+	}
+
+	/* our own overrides, which must win over the driver's */
+	_proc_cache_add("eglCreateImageKHR",
+			(__eglMustCastToProperFunctionPointerType) _my_eglCreateImageKHR);
+	_proc_cache_add("glEGLImageTargetTexture2DOES",
+			(__eglMustCastToProperFunctionPointerType) _my_glEGLImageTargetTexture2DOES);
+	_proc_cache_add("eglSwapBuffersWithDamageKHR",
+			(__eglMustCastToProperFunctionPointerType) _my_eglSwapBuffersWithDamageKHR);
+	_proc_cache_add("eglHybrisQueryFrameStats",
+			(__eglMustCastToProperFunctionPointerType) _my_eglHybrisQueryFrameStats);
+}
+
+static __eglMustCastToProperFunctionPointerType _resolve_proc(const char *procname)
 {
-	EGL_DLSYM(&_eglGetProcAddress, "eglGetProcAddress");
 	if (strcmp(procname, "eglCreateImageKHR") == 0)
 	{
-		return _my_eglCreateImageKHR;
+		return (__eglMustCastToProperFunctionPointerType) _my_eglCreateImageKHR;
 	} 
 	else if (strcmp(procname, "glEGLImageTargetTexture2DOES") == 0)
 	{
-		return _my_glEGLImageTargetTexture2DOES;
+		return (__eglMustCastToProperFunctionPointerType) _my_glEGLImageTargetTexture2DOES;
+	}
+	else if (strcmp(procname, "eglSwapBuffersWithDamageKHR") == 0)
+	{
+		return (__eglMustCastToProperFunctionPointerType) _my_eglSwapBuffersWithDamageKHR;
+	}
+	else if (strcmp(procname, "eglHybrisQueryFrameStats") == 0)
+	{
+		return (__eglMustCastToProperFunctionPointerType) _my_eglHybrisQueryFrameStats;
 	}
 	__eglMustCastToProperFunctionPointerType ret = ws_eglGetProcAddress(procname);
 	if (ret == NULL)
@@ -454,9 +806,31 @@ __eglMustCastToProperFunctionPointerType eglGetProcAddress(const char *procname)
 	else return ret;
 }
 
+__eglMustCastToProperFunctionPointerType eglGetProcAddress(const char *procname)
+{
+	EGL_STAT(eglGetProcAddress);
+	__eglMustCastToProperFunctionPointerType ret;
+	struct _procEntry *entry;
+
+	EGL_INIT();
+	pthread_once(&_proc_cache_once, _proc_cache_init);
+
+	if (!_proc_cache_enabled || procname == NULL)
+		return _resolve_proc(procname);
+
+	entry = _proc_cache_find(procname, _proc_hash(procname));
+	if (entry != NULL)
+		return entry->proc;
+
+	ret = _resolve_proc(procname);
+	_proc_cache_add(procname, ret);
+	return ret;
+}
+
 EGLBoolean eglDestroyImageKHR(EGLDisplay dpy, EGLImageKHR image)
 {
-	EGL_DLSYM(&_eglDestroyImageKHR, "eglDestroyImageKHR");
+	EGL_STAT(eglDestroyImageKHR);
+	EGL_INIT();
 	return (*_eglDestroyImageKHR)(dpy, image);
 }
 
@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Frame pacing per window surface, without a tracer: swap to swap
+ * intervals, time blocked in the driver's eglSwapBuffers(), and time from
+ * the window's last dequeueBuffer() to the swap, which is roughly how long
+ * the frame took to render. The last EGL_FRAME_STATS_WINDOW_HYBRIS frames
+ * are kept for percentiles.
+ *
+ * HYBRIS_EGL_FRAME_STATS=1 enables it, HYBRIS_EGL_REFRESH_RATE (60 by
+ * default) sets the refresh rate dropped frames are counted against, and
+ * HYBRIS_EGL_FRAME_STATS_LOG=<seconds> prints the stats of each surface to
+ * stderr that often.
+ */
+
+#include "framestats.h"
+#include "ws.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <android/system/window.h>
+
+#define WINDOW EGL_FRAME_STATS_WINDOW_HYBRIS
+
+/* Longer gaps between swaps are idle time, not dropped frames */
+#define IDLE_NS 1000000000ULL
+
+struct surface_stats {
+	struct surface_stats *next;
+	EGLSurface surface;
+	struct ANativeWindow *window;
+
+	unsigned long long frames;
+	unsigned long long dropped;
+	unsigned long long last_swap;
+	unsigned long long last_log;
+	unsigned long long render_pending;
+
+	/* rings of the last WINDOW samples, in ns */
+	unsigned long long interval[WINDOW];
+	unsigned long long swap[WINDOW];
+	unsigned long long render[WINDOW];
+	unsigned int intervals;
+};
+
+int egl_frame_stats_enabled = 0;
+
+static unsigned long long _refresh_ns = 1000000000ULL / 60;
+static unsigned long long _log_ns = 0;
+
+static struct surface_stats *_surfaces = NULL;
+static pthread_mutex_t _surfaces_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long long _now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* called with the mutex held */
+static struct surface_stats *_find(EGLSurface surface)
+{
+	struct surface_stats *s;
+
+	for (s = _surfaces; s != NULL; s = s->next)
+		if (s->surface == surface)
+			return s;
+	return NULL;
+}
+
+void egl_frame_stats_add(EGLSurface surface, EGLNativeWindowType window)
+{
+	struct surface_stats *s;
+
+	if (!egl_frame_stats_enabled || surface == EGL_NO_SURFACE)
+		return;
+
+	s = calloc(1, sizeof(*s));
+	if (s == NULL)
+		return;
+
+	s->surface = surface;
+	s->window = (struct ANativeWindow *) window;
+	s->last_log = _now_ns();
+
+	pthread_mutex_lock(&_surfaces_mutex);
+	s->next = _surfaces;
+	_surfaces = s;
+	pthread_mutex_unlock(&_surfaces_mutex);
+}
+
+void egl_frame_stats_remove(EGLSurface surface)
+{
+	struct surface_stats **s, *found = NULL;
+
+	if (!egl_frame_stats_enabled)
+		return;
+
+	pthread_mutex_lock(&_surfaces_mutex);
+	for (s = &_surfaces; *s != NULL; s = &(*s)->next) {
+		if ((*s)->surface == surface) {
+			found = *s;
+			*s = found->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&_surfaces_mutex);
+
+	free(found);
+}
+
+unsigned long long egl_frame_stats_begin(EGLSurface surface)
+{
+	unsigned long long start, dequeued = 0;
+	struct surface_stats *s;
+	struct ANativeWindow *window = NULL;
+
+	if (!egl_frame_stats_enabled)
+		return 0;
+
+	pthread_mutex_lock(&_surfaces_mutex);
+	s = _find(surface);
+	if (s != NULL)
+		window = s->window;
+	pthread_mutex_unlock(&_surfaces_mutex);
+
+	if (window == NULL)
+		return 0;
+
+	/* only hybris windows answer; the driver dequeues again inside the swap */
+	if (window->perform(window, NATIVE_WINDOW_HYBRIS_GET_LAST_DEQUEUE_TIME, &dequeued) != 0)
+		dequeued = 0;
+
+	start = _now_ns();
+
+	pthread_mutex_lock(&_surfaces_mutex);
+	s = _find(surface);
+	if (s != NULL)
+		s->render_pending = dequeued != 0 && dequeued < start ? start - dequeued : 0;
+	pthread_mutex_unlock(&_surfaces_mutex);
+
+	return start;
+}
+
+static int _compare(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *) a;
+	unsigned long long y = *(const unsigned long long *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Percentiles of a ring in us, from a sorted copy */
+static void _percentiles(const unsigned long long *ring, unsigned int count,
+		const double *fractions, EGLint *results, int n)
+{
+	unsigned long long sorted[WINDOW];
+	int i;
+
+	if (count > WINDOW)
+		count = WINDOW;
+
+	if (count == 0) {
+		for (i = 0; i < n; i++)
+			results[i] = 0;
+		return;
+	}
+
+	memcpy(sorted, ring, count * sizeof(sorted[0]));
+	qsort(sorted, count, sizeof(sorted[0]), _compare);
+
+	for (i = 0; i < n; i++)
+		results[i] = sorted[(unsigned int) (fractions[i] * (count - 1) + 0.5)] / 1000;
+}
+
+/* called with the mutex held */
+static void _fill(struct surface_stats *s, EGLFrameStatsHYBRIS *stats)
+{
+	static const double interval_fractions[] = { 0.50, 0.90, 0.99 };
+	static const double fractions[] = { 0.50, 0.99 };
+	EGLint values[3];
+	unsigned int frames = s->frames > WINDOW ? WINDOW : s->frames;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->frames = s->frames;
+	stats->dropped_frames = s->dropped;
+	stats->refresh_period = _refresh_ns / 1000;
+
+	_percentiles(s->interval, s->intervals, interval_fractions, values, 3);
+	stats->interval_p50 = values[0];
+	stats->interval_p90 = values[1];
+	stats->interval_p99 = values[2];
+
+	_percentiles(s->swap, frames, fractions, values, 2);
+	stats->swap_p50 = values[0];
+	stats->swap_p99 = values[1];
+
+	_percentiles(s->render, frames, fractions, values, 2);
+	stats->render_p50 = values[0];
+	stats->render_p99 = values[1];
+}
+
+void egl_frame_stats_end(EGLSurface surface, unsigned long long start)
+{
+	unsigned long long end, interval;
+	EGLFrameStatsHYBRIS stats;
+	struct surface_stats *s;
+	int log = 0;
+
+	if (start == 0)
+		return;
+
+	end = _now_ns();
+
+	pthread_mutex_lock(&_surfaces_mutex);
+	s = _find(surface);
+	if (s == NULL) {
+		pthread_mutex_unlock(&_surfaces_mutex);
+		return;
+	}
+
+	if (s->last_swap != 0) {
+		interval = end - s->last_swap;
+		if (interval < IDLE_NS) {
+			s->interval[s->intervals++ % WINDOW] = interval;
+			if (interval > _refresh_ns + _refresh_ns / 2)
+				s->dropped += (interval + _refresh_ns / 2) / _refresh_ns - 1;
+		}
+	}
+
+	s->swap[s->frames % WINDOW] = end - start;
+	s->render[s->frames % WINDOW] = s->render_pending;
+	s->frames++;
+	s->last_swap = end;
+
+	if (_log_ns != 0 && end - s->last_log >= _log_ns) {
+		s->last_log = end;
+		_fill(s, &stats);
+		log = 1;
+	}
+	pthread_mutex_unlock(&_surfaces_mutex);
+
+	if (log)
+		fprintf(stderr, "libhybris: surface %p: %d frames, %d dropped, interval p50/p90/p99 %d/%d/%d us, "
+				"swap p50/p99 %d/%d us, render p50/p99 %d/%d us\n",
+				surface, stats.frames, stats.dropped_frames,
+				stats.interval_p50, stats.interval_p90, stats.interval_p99,
+				stats.swap_p50, stats.swap_p99, stats.render_p50, stats.render_p99);
+}
+
+EGLBoolean egl_frame_stats_query(EGLDisplay dpy, EGLSurface surface, EGLFrameStatsHYBRIS *stats)
+{
+	struct surface_stats *s;
+
+	if (stats == NULL)
+		return EGL_FALSE;
+
+	pthread_mutex_lock(&_surfaces_mutex);
+	s = _find(surface);
+	if (s != NULL)
+		_fill(s, stats);
+	pthread_mutex_unlock(&_surfaces_mutex);
+
+	return s != NULL;
+}
+
+static void __attribute__((constructor)) _egl_frame_stats_init(void)
+{
+	const char *env = getenv("HYBRIS_EGL_FRAME_STATS");
+
+	if (env == NULL || strcmp(env, "1") != 0)
+		return;
+
+	env = getenv("HYBRIS_EGL_REFRESH_RATE");
+	if (env != NULL && atof(env) > 0)
+		_refresh_ns = 1000000000ULL / atof(env);
+
+	env = getenv("HYBRIS_EGL_FRAME_STATS_LOG");
+	if (env != NULL && atof(env) > 0)
+		_log_ns = atof(env) * 1000000000ULL;
+
+	egl_frame_stats_enabled = 1;
+}
+
+// vim:ts=4:sw=4:noexpandtab
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef LIBHYBRIS_EGL_FRAMESTATS_H
+#define LIBHYBRIS_EGL_FRAMESTATS_H
+
+#include <EGL/egl.h>
+#include "hybris_framestatsext.h"
+
+/* Set when HYBRIS_EGL_FRAME_STATS=1 */
+extern int egl_frame_stats_enabled;
+
+/* Start and stop following a window surface */
+void egl_frame_stats_add(EGLSurface surface, EGLNativeWindowType window);
+void egl_frame_stats_remove(EGLSurface surface);
+
+/* Around the driver's eglSwapBuffers(); begin returns the start time */
+unsigned long long egl_frame_stats_begin(EGLSurface surface);
+void egl_frame_stats_end(EGLSurface surface, unsigned long long start);
+
+/* eglHybrisQueryFrameStats(), handed out by eglGetProcAddress() */
+EGLBoolean egl_frame_stats_query(EGLDisplay dpy, EGLSurface surface, EGLFrameStatsHYBRIS *stats);
+
+#endif /* LIBHYBRIS_EGL_FRAMESTATS_H */
@@ -21,34 +21,189 @@
 #include "helper.h"
 
 #include <assert.h>
-#include <map>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+/**
+ * Pointer to pointer hash map, chained, growing as needed, and safe to use
+ * from several threads. Zero-initialized instances are empty, so that the
+ * maps below need no constructors.
+ **/
+struct PointerMap {
+    struct Entry {
+        void *key;
+        void *value;
+        Entry *next;
+    };
+
+    pthread_mutex_t mutex;
+    Entry **buckets;
+    size_t size;
+    size_t count;
+
+    static size_t hash(void *key, size_t size)
+    {
+        uintptr_t k = (uintptr_t) key;
+
+        /* handles are usually aligned pointers or small integers */
+        k ^= k >> 4;
+        k *= 0x9e3779b1u;
+        return (k >> 8) & (size - 1);
+    }
+
+    void grow()
+    {
+        size_t new_size = size ? size * 2 : 16;
+        Entry **new_buckets = (Entry **) calloc(new_size, sizeof(Entry *));
+
+        if (new_buckets == NULL)
+            return;
+
+        for (size_t i = 0; i < size; i++) {
+            Entry *e = buckets[i];
+            while (e != NULL) {
+                Entry *next = e->next;
+                size_t h = hash(e->key, new_size);
+                e->next = new_buckets[h];
+                new_buckets[h] = e;
+                e = next;
+            }
+        }
+
+        free(buckets);
+        buckets = new_buckets;
+        size = new_size;
+    }
+
+    Entry *lookup(void *key)
+    {
+        if (size == 0)
+            return NULL;
+
+        for (Entry *e = buckets[hash(key, size)]; e != NULL; e = e->next)
+            if (e->key == key)
+                return e;
+        return NULL;
+    }
+
+    /* Returns false if the key was mapped already, leaving it as it was */
+    bool insert(void *key, void *value)
+    {
+        bool inserted = false;
+
+        pthread_mutex_lock(&mutex);
+        if (lookup(key) == NULL) {
+            if (count >= size * 3 / 4)
+                grow();
+
+            Entry *e = (Entry *) malloc(sizeof(Entry));
+            if (e != NULL && size != 0) {
+                size_t h = hash(key, size);
+                e->key = key;
+                e->value = value;
+                e->next = buckets[h];
+                buckets[h] = e;
+                count++;
+                inserted = true;
+            } else {
+                free(e);
+            }
+        }
+        pthread_mutex_unlock(&mutex);
+
+        return inserted;
+    }
+
+    bool find(void *key, void **value)
+    {
+        pthread_mutex_lock(&mutex);
+        Entry *e = lookup(key);
+        if (e != NULL && value != NULL)
+            *value = e->value;
+        pthread_mutex_unlock(&mutex);
+
+        return e != NULL;
+    }
+
+    bool remove(void *key, void **value)
+    {
+        Entry *found = NULL;
+
+        pthread_mutex_lock(&mutex);
+        if (size != 0) {
+            for (Entry **e = &buckets[hash(key, size)]; *e != NULL; e = &(*e)->next) {
+                if ((*e)->key == key) {
+                    found = *e;
+                    *e = found->next;
+                    count--;
+                    break;
+                }
+            }
+        }
+        pthread_mutex_unlock(&mutex);
+
+        if (found == NULL)
+            return false;
+
+        if (value != NULL)
+            *value = found->value;
+        free(found);
+        return true;
+    }
+};
 
 
 /* Keep track of active EGL window surfaces */
-static std::map<EGLSurface,EGLNativeWindowType> _surface_window_map;
+static PointerMap _surface_window_map = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0 };
+
+/* Native display each EGLDisplay was first gotten for */
+static PointerMap _display_map = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0 };
 
 
 void egl_helper_push_mapping(EGLSurface surface, EGLNativeWindowType window)
 {
-    assert(!egl_helper_has_mapping(surface));
+    bool inserted = _surface_window_map.insert((void *) surface, (void *) window);
 
-    _surface_window_map[surface] = window;
+    assert(inserted);
+    (void) inserted;
 }
 
 int egl_helper_has_mapping(EGLSurface surface)
 {
-    return (_surface_window_map.find(surface) != _surface_window_map.end());
+    return _surface_window_map.find((void *) surface, NULL);
+}
+
+EGLNativeWindowType egl_helper_get_mapping(EGLSurface surface)
+{
+    void *window = NULL;
+
+    _surface_window_map.find((void *) surface, &window);
+    return (EGLNativeWindowType) window;
 }
 
 EGLNativeWindowType egl_helper_pop_mapping(EGLSurface surface)
 {
-    std::map<EGLSurface,EGLNativeWindowType>::iterator it;
-    it = _surface_window_map.find(surface);
+    void *window = NULL;
+    bool found = _surface_window_map.remove((void *) surface, &window);
 
     /* Caller must check with egl_helper_has_mapping() before */
-    assert(it != _surface_window_map.end());
+    assert(found);
+    (void) found;
+
+    return (EGLNativeWindowType) window;
+}
+
+void egl_helper_add_display(EGLDisplay display, EGLNativeDisplayType ndt)
+{
+    _display_map.insert((void *) display, (void *) ndt);
+}
+
+EGLNativeDisplayType egl_helper_display_ndt(EGLDisplay display)
+{
+    void *ndt = (void *) EGL_NO_DISPLAY;
 
-    EGLNativeWindowType result = it->second;
-    _surface_window_map.erase(it);
-    return result;
+    _display_map.find((void *) display, &ndt);
+    return (EGLNativeDisplayType) ndt;
 }
@@ -36,9 +36,18 @@ void egl_helper_push_mapping(EGLSurface surface, EGLNativeWindowType window);
 /* Check if a mapping for a surface exist */
 int egl_helper_has_mapping(EGLSurface surface);
 
+/* Window of a surface, or 0 if it has none */
+EGLNativeWindowType egl_helper_get_mapping(EGLSurface surface);
+
 /* Return and remove the mapping for a surface */
 EGLNativeWindowType egl_helper_pop_mapping(EGLSurface surface);
 
+/* Remember the native display a display was gotten for; the first one wins */
+void egl_helper_add_display(EGLDisplay display, EGLNativeDisplayType ndt);
+
+/* Native display of a display, or EGL_NO_DISPLAY if unknown */
+EGLNativeDisplayType egl_helper_display_ndt(EGLDisplay display);
+
 
 #ifdef __cplusplus
 };
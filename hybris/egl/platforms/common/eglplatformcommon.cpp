@@ -246,15 +246,37 @@ extern "C" __eglMustCastToProperFunctionPointerType eglplatformcommon_eglGetProc
 	return NULL;
 }
 
+/* whether ext is in the space separated list exts */
+static bool has_extension(const char *exts, const char *ext)
+{
+	const char *found = exts;
+	size_t len = strlen(ext);
+
+	while ((found = strstr(found, ext)) != NULL) {
+		if ((found == exts || found[-1] == ' ') &&
+		    (found[len] == ' ' || found[len] == '\0'))
+			return true;
+		found += len;
+	}
+
+	return false;
+}
+
 extern "C" const char *eglplatformcommon_eglQueryString(EGLDisplay dpy, EGLint name, const char *(*real_eglQueryString)(EGLDisplay dpy, EGLint name))
 {
-#ifdef WANT_WAYLAND
 	if (name == EGL_EXTENSIONS)
 	{
 		const char *ret = (*real_eglQueryString)(dpy, name);
-		static char eglextensionsbuf[512];
+		static char eglextensionsbuf[2048];
 		assert(ret != NULL);
-		snprintf(eglextensionsbuf, 510, "%sEGL_HYBRIS_native_buffer %s", ret,
+		/* eglSwapBuffersWithDamageKHR() is ours, on top of the driver's if
+		 * it has one; EGL_KHR_partial_update is left to the driver, and so
+		 * is EGL_EXT_buffer_age: only the driver knows whether it kept the
+		 * contents of a buffer, the windows can't tell */
+		bool swap_damage = !has_extension(ret, "EGL_KHR_swap_buffers_with_damage");
+		snprintf(eglextensionsbuf, sizeof(eglextensionsbuf) - 2, "%sEGL_HYBRIS_native_buffer "
+			"%s%s", ret,
+			swap_damage ? "EGL_KHR_swap_buffers_with_damage " : "",
 #ifdef WANT_WAYLAND
 			"EGL_WL_bind_wayland_display "
 #else
@@ -264,6 +286,5 @@ extern "C" const char *eglplatformcommon_eglQueryString(EGLDisplay dpy, EGLint n
 		ret = eglextensionsbuf;
 		return ret;
 	}
-#endif
 	return (*real_eglQueryString)(dpy, name);
 }
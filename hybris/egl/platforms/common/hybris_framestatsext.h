@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EGL_HYBRIS_frame_stats
+#define EGL_HYBRIS_frame_stats 1
+
+/*
+ * Frame pacing of a window surface, collected when HYBRIS_EGL_FRAME_STATS=1.
+ * Percentiles are over the last frames only, see EGL_FRAME_STATS_WINDOW_HYBRIS.
+ * Times are in microseconds.
+ */
+#define EGL_FRAME_STATS_WINDOW_HYBRIS 128
+
+typedef struct {
+    /* swaps since the surface was created */
+    EGLint frames;
+    /* refresh periods missed between swaps, against HYBRIS_EGL_REFRESH_RATE */
+    EGLint dropped_frames;
+    EGLint refresh_period;
+    /* from one eglSwapBuffers() to the next */
+    EGLint interval_p50;
+    EGLint interval_p90;
+    EGLint interval_p99;
+    /* blocked inside eglSwapBuffers() */
+    EGLint swap_p50;
+    EGLint swap_p99;
+    /* from the window's last dequeueBuffer() to eglSwapBuffers(), 0 when unknown */
+    EGLint render_p50;
+    EGLint render_p99;
+} EGLFrameStatsHYBRIS;
+
+typedef EGLBoolean (EGLAPIENTRYP PFNEGLHYBRISQUERYFRAMESTATSPROC)(EGLDisplay dpy, EGLSurface surface, EGLFrameStatsHYBRIS *stats);
+
+#endif
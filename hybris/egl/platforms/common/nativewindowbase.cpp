@@ -3,8 +3,10 @@
 #include <android/hardware/gralloc.h>
 #include "support.h"
 #include <stdarg.h>
+#include <time.h>
 
 #include "nativewindowbase.h"
+#include <ws.h>
 
 #include "logging.h"
 
@@ -12,6 +14,14 @@
 
 #define TRACE(message, ...) HYBRIS_DEBUG_LOG(EGL, message, ##__VA_ARGS__)
 
+static unsigned long long _now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 BaseNativeWindowBuffer::BaseNativeWindowBuffer()
 {
 	TRACE("%p", this);
@@ -109,6 +119,8 @@ BaseNativeWindow::BaseNativeWindow()
 	ANativeWindow::perform = &_perform;
 
 	refcount = 0;
+	lastDequeueTime = 0;
+	dequeuedBuffer = NULL;
 }
 
 BaseNativeWindow::~BaseNativeWindow()
@@ -143,6 +155,30 @@ void BaseNativeWindow::_incRef(struct android_native_base_t* base)
 	__sync_fetch_and_add(&bnw->refcount,1);
 }
 
+int BaseNativeWindow::setSurfaceDamage(BaseNativeWindowBuffer *buffer, const EGLint *rects, EGLint count)
+{
+	TRACE("ignoring %i damage rects of %p", count, buffer);
+	return NO_ERROR;
+}
+
+void BaseNativeWindow::dequeued(BaseNativeWindowBuffer *buffer)
+{
+	lastDequeueTime = _now_ns();
+	dequeuedBuffer = buffer;
+}
+
+void BaseNativeWindow::queued(BaseNativeWindowBuffer *buffer)
+{
+	if (dequeuedBuffer == buffer)
+		dequeuedBuffer = NULL;
+}
+
+void BaseNativeWindow::cancelled(BaseNativeWindowBuffer *buffer)
+{
+	if (dequeuedBuffer == buffer)
+		dequeuedBuffer = NULL;
+}
+
 int BaseNativeWindow::_setSwapInterval(struct ANativeWindow* window, int interval)
 {
 	return static_cast<BaseNativeWindow*>(window)->setSwapInterval(interval);
@@ -154,6 +190,8 @@ int BaseNativeWindow::_dequeueBuffer_DEPRECATED(ANativeWindow* window, ANativeWi
 	int fenceFd = -1;
 	int ret = static_cast<BaseNativeWindow*>(window)->dequeueBuffer(&temp, &fenceFd);
 	*buffer = static_cast<ANativeWindowBuffer*>(temp);
+	if (ret == NO_ERROR)
+		static_cast<BaseNativeWindow*>(window)->dequeued(temp);
 	return ret;
 }
 
@@ -162,6 +200,8 @@ int BaseNativeWindow::_dequeueBuffer(struct ANativeWindow *window, ANativeWindow
 	BaseNativeWindowBuffer *nativeBuffer = static_cast<BaseNativeWindowBuffer*>(*buffer);
 	int ret = static_cast<BaseNativeWindow*>(window)->dequeueBuffer(&nativeBuffer, fenceFd);
 	*buffer = static_cast<ANativeWindowBuffer*>(nativeBuffer);
+	if (ret == NO_ERROR)
+		static_cast<BaseNativeWindow*>(window)->dequeued(nativeBuffer);
 	return ret;
 }
 
@@ -170,6 +210,7 @@ int BaseNativeWindow::_queueBuffer_DEPRECATED(struct ANativeWindow* window, ANat
 	BaseNativeWindow *nativeWindow = static_cast<BaseNativeWindow*>(window);
 	BaseNativeWindowBuffer *nativeBuffer = static_cast<BaseNativeWindowBuffer*>(buffer);
 
+	nativeWindow->queued(nativeBuffer);
 	return nativeWindow->queueBuffer(nativeBuffer, -1);
 }
 
@@ -178,6 +219,7 @@ int BaseNativeWindow::_queueBuffer(struct ANativeWindow *window, ANativeWindowBu
 	BaseNativeWindow *nativeWindow = static_cast<BaseNativeWindow*>(window);
 	BaseNativeWindowBuffer *nativeBuffer = static_cast<BaseNativeWindowBuffer*>(buffer);
 
+	nativeWindow->queued(nativeBuffer);
 	return nativeWindow->queueBuffer(nativeBuffer, fenceFd);
 }
 
@@ -186,6 +228,7 @@ int BaseNativeWindow::_cancelBuffer_DEPRECATED(struct ANativeWindow* window, ANa
 	BaseNativeWindow *nativeWindow = static_cast<BaseNativeWindow*>(window);
 	BaseNativeWindowBuffer *nativeBuffer = static_cast<BaseNativeWindowBuffer*>(buffer);
 
+	nativeWindow->cancelled(nativeBuffer);
 	return nativeWindow->cancelBuffer(nativeBuffer, -1);
 }
 
@@ -194,6 +237,7 @@ int BaseNativeWindow::_cancelBuffer(struct ANativeWindow *window, ANativeWindowB
 	BaseNativeWindow *nativeWindow = static_cast<BaseNativeWindow*>(window);
 	BaseNativeWindowBuffer *nativeBuffer = static_cast<BaseNativeWindowBuffer*>(buffer);
 
+	nativeWindow->cancelled(nativeBuffer);
 	return nativeWindow->cancelBuffer(nativeBuffer, fenceFd);
 }
 
@@ -361,6 +405,20 @@ int BaseNativeWindow::_perform(struct ANativeWindow* window, int operation, ...
 		TRACE("set post transform crop");
 		break;
 #endif
+	case NATIVE_WINDOW_HYBRIS_SET_SURFACE_DAMAGE:
+	{
+		const EGLint *rects = va_arg(args, const EGLint *);
+		EGLint count = va_arg(args, EGLint);
+		va_end(args);
+		return self->setSurfaceDamage(self->dequeuedBuffer, rects, count);
+	}
+	case NATIVE_WINDOW_HYBRIS_GET_LAST_DEQUEUE_TIME:
+	{
+		unsigned long long *time = va_arg(args, unsigned long long *);
+		va_end(args);
+		*time = self->lastDequeueTime;
+		return NO_ERROR;
+	}
 	}
 	va_end(args);
 	return NO_ERROR;
@@ -80,7 +80,19 @@ protected:
 	virtual int setBuffersDimensions(int width, int height) = 0;
 	virtual int setUsage(int usage) = 0;
 	virtual int setBufferCount(int cnt) = 0;
+	// damage of buffer, the one dequeued when NATIVE_WINDOW_HYBRIS_SET_SURFACE_DAMAGE
+	// came, or NULL if none was; it only applies if that buffer is the next queued.
+	// Windows that always post the whole buffer keep this default, which ignores it
+	virtual int setSurfaceDamage(BaseNativeWindowBuffer *buffer, const EGLint *rects, EGLint count);
 private:
+	unsigned long long lastDequeueTime;
+	// dequeued and neither queued nor cancelled yet, only ever compared
+	BaseNativeWindowBuffer *dequeuedBuffer;
+
+	void dequeued(BaseNativeWindowBuffer *buffer);
+	void queued(BaseNativeWindowBuffer *buffer);
+	void cancelled(BaseNativeWindowBuffer *buffer);
+
 	static int _setSwapInterval(struct ANativeWindow* window, int interval);
 	static int _dequeueBuffer_DEPRECATED(ANativeWindow* window, ANativeWindowBuffer** buffer);
 	static const char *_native_window_operation(int what);
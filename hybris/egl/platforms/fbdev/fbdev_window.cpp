@@ -16,6 +16,7 @@
 
 #include "fbdev_window.h"
 #include "logging.h"
+#include "metrics.h"
 
 #include <errno.h>
 #include <assert.h>
@@ -148,6 +149,7 @@ int FbDevNativeWindow::dequeueBuffer(BaseNativeWindowBuffer** buffer, int *fence
 {
     HYBRIS_TRACE_BEGIN("fbdev-platform", "dequeueBuffer", "");
     FbDevNativeWindowBuffer* fbnb=NULL;
+    uint64_t wait_start = HYBRIS_METRIC_START_US();
 
     pthread_mutex_lock(&_mutex);
 
@@ -210,9 +212,11 @@ int FbDevNativeWindow::dequeueBuffer(BaseNativeWindowBuffer** buffer, int *fence
     }
 
     HYBRIS_TRACE_END("fbdev-platform", "dequeueBuffer-wait", "");
+    HYBRIS_METRIC_RECORD("fbdev.dequeue_wait_us", hybris_metric_now_us() - wait_start);
     assert(fbnb!=NULL);
     fbnb->busy = 1;
     m_freeBufs--;
+    HYBRIS_METRIC_GAUGE("fbdev.free_buffers", m_freeBufs);
 
     *buffer = fbnb;
     *fenceFd = -1;
@@ -272,6 +276,8 @@ int FbDevNativeWindow::queueBuffer(BaseNativeWindowBuffer* buffer, int fenceFd)
     m_frontBuf = fbnb;
 
     m_freeBufs++;
+    HYBRIS_METRIC_GAUGE("fbdev.free_buffers", m_freeBufs);
+    HYBRIS_METRIC_COUNT("fbdev.posts", 1);
 
     TRACE("%lu %p %p",pthread_self(), m_frontBuf, fbnb);
 
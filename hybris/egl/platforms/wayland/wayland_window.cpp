@@ -32,6 +32,7 @@
 #include <errno.h>
 
 #include "logging.h"
+#include "metrics.h"
 #include <android/android-version.h>
 #include <eglhybris.h>
 
@@ -175,6 +176,7 @@ WaylandNativeWindow::WaylandNativeWindow(struct wl_egl_window *window, struct wl
     this->m_format = 1;
     this->wl_queue = wl_display_create_queue(display);
     this->frame_callback = NULL;
+    this->m_damageBuffer = NULL;
     this->registry = wl_display_get_registry(display);
     wl_proxy_set_queue((struct wl_proxy *) this->registry,
             this->wl_queue);
@@ -287,6 +289,7 @@ void WaylandNativeWindow::releaseBuffer(struct wl_buffer *buffer)
 
     ++m_freeBufs;
     HYBRIS_TRACE_COUNTER("wayland-platform", "m_freeBufs", "%i", m_freeBufs);
+    HYBRIS_METRIC_GAUGE("wayland.free_buffers", m_freeBufs);
     for (it = m_bufList.begin(); it != m_bufList.end(); it++)
     {  
         (*it)->youngest = 0;
@@ -304,6 +307,7 @@ int WaylandNativeWindow::dequeueBuffer(BaseNativeWindowBuffer **buffer, int *fen
     HYBRIS_TRACE_BEGIN("wayland-platform", "dequeueBuffer", "");
 
     WaylandNativeWindowBuffer *wnb=NULL;
+    uint64_t wait_start = HYBRIS_METRIC_START_US();
     TRACE("%p", buffer);
 
     lock();
@@ -316,6 +320,7 @@ int WaylandNativeWindow::dequeueBuffer(BaseNativeWindowBuffer **buffer, int *fen
 
         pthread_cond_wait(&cond,&mutex);
     }
+    HYBRIS_METRIC_RECORD("wayland.dequeue_wait_us", hybris_metric_now_us() - wait_start);
     std::list<WaylandNativeWindowBuffer *>::iterator it = m_bufList.begin();
     for (; it != m_bufList.end(); it++)
     {
@@ -365,6 +370,7 @@ int WaylandNativeWindow::dequeueBuffer(BaseNativeWindowBuffer **buffer, int *fen
     --m_freeBufs;
 
     HYBRIS_TRACE_COUNTER("wayland-platform", "m_freeBufs", "%i", m_freeBufs);
+    HYBRIS_METRIC_GAUGE("wayland.free_buffers", m_freeBufs);
     HYBRIS_TRACE_BEGIN("wayland-platform", "dequeueBuffer_gotBuffer", "-%p", wnb);
     HYBRIS_TRACE_END("wayland-platform", "dequeueBuffer_gotBuffer", "-%p", wnb);
     HYBRIS_TRACE_END("wayland-platform", "dequeueBuffer_wait_for_buffer", "");
@@ -509,11 +515,10 @@ int WaylandNativeWindow::queueBuffer(BaseNativeWindowBuffer* buffer, int fenceFd
         wl_buffer_add_listener(wnb->wlbuffer, &wl_buffer_listener, this);
         wl_proxy_set_queue((struct wl_proxy *) wnb->wlbuffer, this->wl_queue);
     }
-    TRACE("%p DAMAGE AREA: %dx%d", wnb, wnb->width, wnb->height);
     HYBRIS_TRACE_BEGIN("wayland-platform", "queueBuffer_attachdamagecommit", "-resource@%i", wl_proxy_get_id((struct wl_proxy *) wnb->wlbuffer));
 
     wl_surface_attach(m_window->surface, wnb->wlbuffer, 0, 0);
-    wl_surface_damage(m_window->surface, 0, 0, wnb->width, wnb->height);
+    damage(wnb);
     wl_surface_commit(m_window->surface);
     wl_display_flush(m_display);
     HYBRIS_TRACE_END("wayland-platform", "queueBuffer_attachdamagecommit", "-resource@%i", wl_proxy_get_id((struct wl_proxy *) wnb->wlbuffer));
@@ -568,6 +573,7 @@ int WaylandNativeWindow::cancelBuffer(BaseNativeWindowBuffer* buffer, int fenceF
     wnb->busy = 0;
     ++m_freeBufs;
     HYBRIS_TRACE_COUNTER("wayland-platform", "m_freeBufs", "%i", m_freeBufs);
+    HYBRIS_METRIC_GAUGE("wayland.free_buffers", m_freeBufs);
 
     for (it = m_bufList.begin(); it != m_bufList.end(); it++)
     {
@@ -575,6 +581,11 @@ int WaylandNativeWindow::cancelBuffer(BaseNativeWindowBuffer* buffer, int fenceF
     }
     wnb->youngest = 1;
 
+    if (m_damageBuffer == wnb) {
+        m_damage.clear();
+        m_damageBuffer = NULL;
+    }
+
     pthread_cond_signal(&cond);
 
     HYBRIS_TRACE_END("wayland-platform", "cancelBuffer", "-%p", wnb);
@@ -649,6 +660,10 @@ void WaylandNativeWindow::destroyBuffer(WaylandNativeWindowBuffer* wnb)
     wnb->wlbuffer = NULL;
     wnb->common.decRef(&wnb->common);
     m_freeBufs--;
+    if (m_damageBuffer == wnb) {
+        m_damage.clear();
+        m_damageBuffer = NULL;
+    }
 }
 
 void WaylandNativeWindow::destroyBuffers()
@@ -678,6 +693,44 @@ WaylandNativeWindowBuffer *WaylandNativeWindow::addBuffer() {
 }
 
 
+int WaylandNativeWindow::setSurfaceDamage(BaseNativeWindowBuffer *buffer, const EGLint *rects, EGLint count)
+{
+    TRACE("%p count:%i", buffer, count);
+
+    lock();
+    if (buffer != NULL && rects != NULL && count > 0) {
+        m_damage.assign(rects, rects + count * 4);
+        m_damageBuffer = buffer;
+    } else {
+        m_damage.clear();
+        m_damageBuffer = NULL;
+    }
+    unlock();
+
+    return NO_ERROR;
+}
+
+/* Damages what was set for this buffer, or all of it; called locked.
+ * Damage set for any other buffer is stale by now and dropped. */
+void WaylandNativeWindow::damage(WaylandNativeWindowBuffer *wnb)
+{
+    if (m_damageBuffer != wnb || m_damage.empty()) {
+        TRACE("%p DAMAGE AREA: %dx%d", wnb, wnb->width, wnb->height);
+        wl_surface_damage(m_window->surface, 0, 0, wnb->width, wnb->height);
+    } else {
+        for (size_t i = 0; i + 3 < m_damage.size(); i += 4) {
+            /* EGL counts y from the bottom, wayland from the top */
+            EGLint x = m_damage[i], y = m_damage[i + 1];
+            EGLint w = m_damage[i + 2], h = m_damage[i + 3];
+
+            TRACE("%p DAMAGE AREA: %dx%d+%d+%d", wnb, w, h, x, wnb->height - y - h);
+            wl_surface_damage(m_window->surface, x, wnb->height - y - h, w, h);
+        }
+    }
+    m_damage.clear();
+    m_damageBuffer = NULL;
+}
+
 int WaylandNativeWindow::setBufferCount(int cnt) {
     int start = 0;
 
@@ -38,6 +38,7 @@ extern "C" {
 #include <pthread.h>
 }
 #include <list>
+#include <vector>
 
 class WaylandNativeWindowBuffer : public BaseNativeWindowBuffer
 {
@@ -135,6 +136,7 @@ protected:
     virtual int setBuffersFormat(int format);
     virtual int setBuffersDimensions(int width, int height);
     virtual int setBufferCount(int cnt);
+    virtual int setSurfaceDamage(BaseNativeWindowBuffer *buffer, const EGLint *rects, EGLint count);
 
 private:
     WaylandNativeWindowBuffer *addBuffer();
@@ -160,6 +162,11 @@ private:
     pthread_cond_t cond;
     int m_freeBufs;
     struct wl_callback *frame_callback;
+    /* x, y, width, height quadruples for when m_damageBuffer is queued,
+     * empty for all of it */
+    std::vector<EGLint> m_damage;
+    BaseNativeWindowBuffer *m_damageBuffer;
+    void damage(WaylandNativeWindowBuffer *wnb);
     static int wayland_roundtrip(WaylandNativeWindow *display);
 };
 
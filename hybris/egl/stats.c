@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "logging.h"
+#include "hooks_libmap.h"
+
+/* bucket 0 counts calls under 1 ns, bucket i calls in [2^(i-1), 2^i) ns */
+#define STAT_BUCKETS 32
+
+#define EGL_STAT_NAME(name) #name,
+
+static const char *_stat_names[EGL_STAT_MAX] = {
+	EGL_STATS_ENTRY_POINTS(EGL_STAT_NAME)
+};
+
+struct egl_counters {
+	unsigned long long calls;
+	unsigned long long total_ns;
+	unsigned long long max_ns;
+	unsigned long long buckets[STAT_BUCKETS];
+};
+
+/*
+ * Only the owning thread writes to its table, so recording takes no lock
+ * and no atomics. Tables of exited threads are recycled.
+ */
+struct egl_thread_stats {
+	struct egl_thread_stats *next;
+	int retired;
+	struct egl_counters counters[EGL_STAT_MAX];
+};
+
+int egl_stats_enabled = 0;
+
+static struct egl_thread_stats *_threads = NULL;
+static pthread_mutex_t _threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t _threads_key;
+
+static __thread struct egl_thread_stats *_stats;
+static __thread int _stats_exiting;
+
+static void _thread_stats_retire(void *data)
+{
+	struct egl_thread_stats *stats = data;
+
+	pthread_mutex_lock(&_threads_mutex);
+	stats->retired = 1;
+	pthread_mutex_unlock(&_threads_mutex);
+
+	_stats = NULL;
+	_stats_exiting = 1;
+}
+
+static struct egl_thread_stats *_thread_stats(void)
+{
+	struct egl_thread_stats *stats;
+
+	if (_stats != NULL || _stats_exiting)
+		return _stats;
+
+	pthread_mutex_lock(&_threads_mutex);
+	for (stats = _threads; stats != NULL; stats = stats->next) {
+		if (stats->retired) {
+			stats->retired = 0;
+			break;
+		}
+	}
+	if (stats == NULL) {
+		stats = calloc(1, sizeof(*stats));
+		if (stats != NULL) {
+			stats->next = _threads;
+			_threads = stats;
+		}
+	}
+	pthread_mutex_unlock(&_threads_mutex);
+
+	if (stats != NULL)
+		pthread_setspecific(_threads_key, stats);
+
+	_stats = stats;
+	return stats;
+}
+
+void egl_stats_record(struct egl_stat_call *call)
+{
+	struct egl_thread_stats *stats = _thread_stats();
+	struct egl_counters *counters;
+	unsigned long long ns;
+	struct timespec now;
+	int bucket = 0;
+
+	if (stats == NULL)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = now.tv_sec * 1000000000ULL + now.tv_nsec - call->start;
+
+	if (ns > 0) {
+		bucket = 64 - __builtin_clzll(ns);
+		if (bucket >= STAT_BUCKETS)
+			bucket = STAT_BUCKETS - 1;
+	}
+
+	counters = &stats->counters[call->stat];
+	counters->calls++;
+	counters->total_ns += ns;
+	counters->buckets[bucket]++;
+	if (ns > counters->max_ns)
+		counters->max_ns = ns;
+}
+
+/* Upper bound of the bucket holding the given fraction of the calls, in us */
+static double _percentile(const struct egl_counters *c, double fraction)
+{
+	unsigned long long target = c->calls * fraction + 0.5;
+	unsigned long long seen = 0;
+	int i;
+
+	for (i = 0; i < STAT_BUCKETS; i++) {
+		seen += c->buckets[i];
+		if (seen >= target && seen > 0)
+			break;
+	}
+
+	if (i >= STAT_BUCKETS - 1 || (1ULL << i) > c->max_ns)
+		return c->max_ns / 1000.0;
+	return (1ULL << i) / 1000.0;
+}
+
+void egl_stats_report(FILE *out)
+{
+	struct egl_thread_stats *stats;
+	int stat, i;
+
+	if (!egl_stats_enabled)
+		return;
+
+	fprintf(out, "libhybris: EGL calls (pid %d, percentiles are bucket bounds)\n", getpid());
+	fprintf(out, "%-32s %12s %10s %10s %10s %10s %10s\n",
+			"entry point", "calls", "avg us", "p50 us", "p90 us", "p99 us", "max us");
+
+	pthread_mutex_lock(&_threads_mutex);
+	for (stat = 0; stat < EGL_STAT_MAX; stat++) {
+		struct egl_counters total;
+
+		memset(&total, 0, sizeof(total));
+		for (stats = _threads; stats != NULL; stats = stats->next) {
+			const struct egl_counters *c = &stats->counters[stat];
+
+			total.calls += c->calls;
+			total.total_ns += c->total_ns;
+			if (c->max_ns > total.max_ns)
+				total.max_ns = c->max_ns;
+			for (i = 0; i < STAT_BUCKETS; i++)
+				total.buckets[i] += c->buckets[i];
+		}
+
+		if (total.calls == 0)
+			continue;
+
+		fprintf(out, "%-32s %12llu %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+				_stat_names[stat], total.calls,
+				total.total_ns / 1000.0 / total.calls,
+				_percentile(&total, 0.50), _percentile(&total, 0.90),
+				_percentile(&total, 0.99), total.max_ns / 1000.0);
+	}
+	pthread_mutex_unlock(&_threads_mutex);
+
+	fflush(out);
+}
+
+static void __attribute__((constructor)) _egl_stats_init(void)
+{
+	const char *env = getenv("HYBRIS_EGL_STATS");
+
+	if (env == NULL || strcmp(env, "1") != 0)
+		return;
+
+	if (pthread_key_create(&_threads_key, _thread_stats_retire) != 0)
+		return;
+
+	hybris_libmap_add_report(egl_stats_report);
+	egl_stats_enabled = 1;
+
+	HYBRIS_DEBUG_LOG(EGL, "EGL statistics enabled");
+}
+
+// vim:ts=4:sw=4:noexpandtab
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef LIBHYBRIS_EGL_STATS_H
+#define LIBHYBRIS_EGL_STATS_H
+
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Call counts and latency histograms of the EGL entry points, kept per
+ * thread, enabled with HYBRIS_EGL_STATS=1. They are printed at
+ * eglTerminate(), at exit, and on HYBRIS_STATS_SIGNAL.
+ */
+
+#define EGL_STATS_ENTRY_POINTS(X) \
+	X(eglGetError) X(eglGetDisplay) X(eglInitialize) X(eglTerminate) \
+	X(eglQueryString) X(eglGetConfigs) X(eglChooseConfig) X(eglGetConfigAttrib) \
+	X(eglCreateWindowSurface) X(eglCreatePbufferSurface) X(eglCreatePixmapSurface) \
+	X(eglDestroySurface) X(eglQuerySurface) X(eglBindAPI) X(eglQueryAPI) \
+	X(eglWaitClient) X(eglReleaseThread) X(eglCreatePbufferFromClientBuffer) \
+	X(eglSurfaceAttrib) X(eglBindTexImage) X(eglReleaseTexImage) X(eglSwapInterval) \
+	X(eglCreateContext) X(eglDestroyContext) X(eglMakeCurrent) \
+	X(eglGetCurrentContext) X(eglGetCurrentSurface) X(eglGetCurrentDisplay) \
+	X(eglQueryContext) X(eglWaitGL) X(eglWaitNative) X(eglSwapBuffers) \
+	X(eglCopyBuffers) X(eglCreateImageKHR) X(eglDestroyImageKHR) \
+	X(glEGLImageTargetTexture2DOES) X(eglGetProcAddress) \
+	X(eglSwapBuffersWithDamageKHR)
+
+#define EGL_STAT_ENUM(name) EGL_STAT_##name,
+
+enum egl_stat {
+	EGL_STATS_ENTRY_POINTS(EGL_STAT_ENUM)
+	EGL_STAT_MAX
+};
+
+struct egl_stat_call {
+	enum egl_stat stat;
+	unsigned long long start;
+};
+
+extern int egl_stats_enabled;
+
+void egl_stats_record(struct egl_stat_call *call);
+void egl_stats_report(FILE *out);
+
+static inline struct egl_stat_call egl_stats_begin(enum egl_stat stat)
+{
+	struct egl_stat_call call = { stat, 0 };
+	struct timespec ts;
+
+	if (__builtin_expect(egl_stats_enabled, 0)) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		call.start = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+
+	return call;
+}
+
+static inline void egl_stats_end(struct egl_stat_call *call)
+{
+	if (__builtin_expect(call->start != 0, 0))
+		egl_stats_record(call);
+}
+
+/* Times the rest of the enclosing function, whichever way it returns */
+#define EGL_STAT(name) \
+	struct egl_stat_call _egl_stat_call __attribute__((cleanup(egl_stats_end))) = \
+		egl_stats_begin(EGL_STAT_##name)
+
+#endif /* LIBHYBRIS_EGL_STATS_H */
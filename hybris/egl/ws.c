@@ -20,37 +20,41 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
+#include <pthread.h>
 
 static struct ws_module *ws = NULL;
+static pthread_once_t _ws_once = PTHREAD_ONCE_INIT;
 
-static void _init_ws()
+static void _load_ws()
 {
-	if (ws == NULL)
-	{
-		char ws_name[2048];
-		char *egl_platform;
+	char ws_name[2048];
+	char *egl_platform;
 
-		// Mesa uses EGL_PLATFORM for its own purposes.
-		// Add HYBRIS_EGLPLATFORM to avoid the conflicts
-		egl_platform=getenv("HYBRIS_EGLPLATFORM");
+	// Mesa uses EGL_PLATFORM for its own purposes.
+	// Add HYBRIS_EGLPLATFORM to avoid the conflicts
+	egl_platform=getenv("HYBRIS_EGLPLATFORM");
 
-		if (egl_platform == NULL)
-			egl_platform=getenv("EGL_PLATFORM");
+	if (egl_platform == NULL)
+		egl_platform=getenv("EGL_PLATFORM");
 
-		if (egl_platform == NULL)
-			egl_platform = DEFAULT_EGL_PLATFORM;
+	if (egl_platform == NULL)
+		egl_platform = DEFAULT_EGL_PLATFORM;
 
-		snprintf(ws_name, 2048, PKGLIBDIR "eglplatform_%s.so", egl_platform);
+	snprintf(ws_name, 2048, PKGLIBDIR "eglplatform_%s.so", egl_platform);
 
-		void *wsmod = (void *) dlopen(ws_name, RTLD_LAZY);
-		if (wsmod==NULL)
-		{
-			fprintf(stderr, "ERROR: %s\n\t%s\n", ws_name, dlerror());
-			assert(0);
-		}
-		ws = dlsym(wsmod, "ws_module_info");
-		assert(ws != NULL);
+	void *wsmod = (void *) dlopen(ws_name, RTLD_LAZY);
+	if (wsmod==NULL)
+	{
+		fprintf(stderr, "ERROR: %s\n\t%s\n", ws_name, dlerror());
+		assert(0);
 	}
+	ws = dlsym(wsmod, "ws_module_info");
+	assert(ws != NULL);
+}
+
+static void _init_ws()
+{
+	pthread_once(&_ws_once, _load_ws);
 }
 
 
@@ -18,4 +18,20 @@ __eglMustCastToProperFunctionPointerType ws_eglGetProcAddress(const char *procna
 void ws_passthroughImageKHR(EGLContext *ctx, EGLenum *target, EGLClientBuffer *buffer, const EGLint **attrib_list);
 const char *ws_eglQueryString(EGLDisplay dpy, EGLint name, const char *(*real_eglQueryString)(EGLDisplay dpy, EGLint name));
 
+/*
+ * Private ANativeWindow::perform() operations between the EGL wrapper and
+ * the hybris native windows, outside the range Android uses. Other windows
+ * ignore them or fail, so callers must not rely on an answer.
+ */
+
+/* (unsigned long long *ns): CLOCK_MONOTONIC time of the last dequeueBuffer(), 0 if none */
+#define NATIVE_WINDOW_HYBRIS_GET_LAST_DEQUEUE_TIME 0x48590001
+
+/*
+ * (const EGLint *rects, EGLint n_rects): damage of the next queued buffer, as
+ * x, y, width, height with the origin at the bottom left, like
+ * eglSwapBuffersWithDamageKHR(). n_rects 0 damages the whole buffer.
+ */
+#define NATIVE_WINDOW_HYBRIS_SET_SURFACE_DAMAGE 0x48590002
+
 #endif
@@ -51,6 +51,51 @@ extern "C" {
 	int property_get(const char *key, char *value, const char *default_value);
 	int property_list(void (*propfn)(const char *key, const char *value, void *cookie), void *cookie);
 
+	/* Fetch count properties at once, over a single connection to the
+	 * property service. Each values[i] must hold PROP_VALUE_MAX bytes and is
+	 * left empty if keys[i] is unset. Returns how many are set, or -1 */
+	int property_get_many(const char **keys, char **values, int count);
+
+	/* Block until key has a value other than old_value (NULL or "" for
+	 * unset), or for at most timeout milliseconds unless timeout is -1.
+	 * Returns 0 on change, -ETIMEDOUT otherwise */
+	int property_wait(const char *key, const char *old_value, int timeout);
+
+	/* Upper bound for sleeps when changes can't be waited for, as with
+	 * the ones made by init */
+#define PROPERTY_WAIT_POLL_MS 250
+
+	/* Hits and misses of the per-process property cache, which is
+	 * configured with HYBRIS_PROPERTY_CACHE_TTL (milliseconds) and
+	 * HYBRIS_PROPERTY_CACHE_RO (off by default). HYBRIS_PROPERTY_PREFETCH=1
+	 * fills it with the whole property list on first use */
+	void property_cache_stats(unsigned long *hits, unsigned long *misses);
+
+	/* Shared property area, compatible with the bionic __system_property_*
+	 * API. It is created by the first process using it, from build.prop and
+	 * the property service, and kept up to date by property_set(). Lookups
+	 * don't make any system call. */
+	typedef struct prop_info prop_info;
+
+	/* Changes made by init only reach the area when it is refreshed from
+	 * the property list, which needs LISTPROP from the property service and
+	 * a process allowed to write the area. Returns 1 if the area was
+	 * refreshed within HYBRIS_PROPERTY_AREA_TTL milliseconds (default 1000),
+	 * refreshing it first if it is older and this process can, 0 if its
+	 * values may be stale */
+	int property_area_synced(void);
+
+	const prop_info *property_find(const char *name);
+	int property_read(const prop_info *pi, char *name, char *value);
+	unsigned int property_serial(const prop_info *pi);
+	unsigned int property_area_serial();
+	/* Wait for the serial of pi, or of the whole area for NULL, to differ
+	 * from old_serial, see property_wait(). Only changes made through
+	 * libhybris move the serials. Returns the new serial */
+	unsigned int property_wait_serial(const prop_info *pi, unsigned int old_serial, int timeout);
+	const prop_info *property_find_nth(unsigned n);
+	int property_foreach(void (*propfn)(const prop_info *pi, void *cookie), void *cookie);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,524 @@
+/*
+ * Copyright (c) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include <hybris/properties/properties.h>
+#include "properties_p.h"
+
+#define PROP_AREA_MAGIC 0x504f5250
+#define PROP_AREA_VERSION 2
+
+/* how long the area may go without a refresh and still be trusted */
+#define PROP_AREA_DEFAULT_TTL 1000
+#define PROP_AREA_CAPACITY 2048
+
+static const char default_area_path[] = "/dev/shm/hybris-properties";
+
+/* same layout as the prop_info of pre-4.4 bionic */
+struct prop_info {
+	char name[PROP_NAME_MAX];
+	volatile uint32_t serial;
+	char value[PROP_VALUE_MAX];
+};
+
+/* The area serial is odd while the toc is being modified, and grows by two
+ * for every change. Entries never move once added, only the toc of sorted
+ * indices does, so prop_info pointers stay valid forever. Entry serials are
+ * odd while the value is being written.
+ *
+ * Waiters sleep on a futex on either serial. Most processes only have the
+ * area mapped read-only, so they can't announce themselves in it: writers
+ * always make the wake up call instead, which is cheap next to a set.
+ *
+ * Changes made by init only reach the area when a process that can write it
+ * refreshes it from the property list, see property_area_synced(); synced
+ * tells when that last happened, in CLOCK_MONOTONIC milliseconds (0 for
+ * never). */
+struct prop_area {
+	uint32_t magic;
+	uint32_t version;
+	volatile uint32_t serial;
+	volatile uint32_t count;
+	uint32_t capacity;
+	volatile uint32_t synced;
+	uint32_t reserved[2];
+	uint32_t toc[PROP_AREA_CAPACITY];
+	struct prop_info info[PROP_AREA_CAPACITY];
+};
+
+static struct prop_area *area = NULL;
+static int area_fd = -1;
+static int area_writable = 0;
+static long long area_ttl = PROP_AREA_DEFAULT_TTL;
+/* when this process last failed to refresh the area */
+static uint32_t area_sync_failed = 0;
+static pthread_once_t area_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t area_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* private:
+ * number of entries, never more than the area can hold, whatever the file says.
+ */
+static uint32_t area_count()
+{
+	uint32_t count = area->count;
+
+	return count < PROP_AREA_CAPACITY ? count : PROP_AREA_CAPACITY;
+}
+
+/* private:
+ * binary search the toc, must be called with a stable area serial.
+ *
+ * returns the toc position of `name', or -(insertion position) - 1.
+ */
+static int area_search_internal(const char *name)
+{
+	uint32_t count = area_count();
+	int lo = 0, hi = (int) count - 1;
+
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		uint32_t index = area->toc[mid];
+		int cmp;
+
+		if (index >= count)
+			return -1;
+
+		cmp = strncmp(area->info[index].name, name, PROP_NAME_MAX);
+
+		if (cmp == 0)
+			return mid;
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+
+	return -lo - 1;
+}
+
+static int futex_wait(volatile uint32_t *addr, uint32_t val, const struct timespec *timeout)
+{
+	return syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+static void futex_wake(volatile uint32_t *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static long long now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* the low bits of now_ms(), never 0, which stands for never */
+static uint32_t stamp_ms()
+{
+	uint32_t now = (uint32_t) now_ms();
+
+	return now ? now : 1;
+}
+
+/* whether stamp is set and less than the ttl old, wrapping included */
+static int stamp_recent(uint32_t stamp)
+{
+	return stamp != 0 && (long long) (uint32_t) (stamp_ms() - stamp) < area_ttl;
+}
+
+/* private:
+ * add or update a property, with the area lock held.
+ */
+static void area_set_internal(const char *name, const char *value, int overwrite)
+{
+	struct prop_info *pi;
+	uint32_t count;
+	int pos;
+
+	if (strlen(name) >= PROP_NAME_MAX || strlen(value) >= PROP_VALUE_MAX)
+		return;
+
+	pos = area_search_internal(name);
+	if (pos >= 0) {
+		if (!overwrite)
+			return;
+
+		pi = &area->info[area->toc[pos]];
+		/* refreshes rewrite everything, only real changes wake waiters */
+		if (strncmp(pi->value, value, PROP_VALUE_MAX) == 0)
+			return;
+
+		pi->serial++;
+		__sync_synchronize();
+		strncpy(pi->value, value, PROP_VALUE_MAX);
+		__sync_synchronize();
+		pi->serial++;
+		__sync_fetch_and_add(&area->serial, 2);
+		futex_wake(&pi->serial);
+		futex_wake(&area->serial);
+		return;
+	}
+
+	if (area_count() >= PROP_AREA_CAPACITY) {
+		fprintf(stderr, "libhybris: property area full, not adding %s\n", name);
+		return;
+	}
+
+	count = area_count();
+	pos = -pos - 1;
+	pi = &area->info[count];
+	strncpy(pi->name, name, PROP_NAME_MAX);
+	strncpy(pi->value, value, PROP_VALUE_MAX);
+	pi->serial = 0;
+
+	__sync_fetch_and_add(&area->serial, 1);
+	__sync_synchronize();
+	memmove(&area->toc[pos + 1], &area->toc[pos],
+			(count - pos) * sizeof(area->toc[0]));
+	area->toc[pos] = count;
+	area->count = count + 1;
+	__sync_synchronize();
+	__sync_fetch_and_add(&area->serial, 1);
+	futex_wake(&area->serial);
+}
+
+static void area_populate_cb(const char *key, const char *value, void *cookie)
+{
+	area_set_internal(key, value, *(int *) cookie);
+}
+
+/* private:
+ * fill a fresh area. values from the property service win over build.prop.
+ */
+static void area_populate_internal()
+{
+	int overwrite;
+
+	memset(area, 0, sizeof(*area));
+	area->capacity = PROP_AREA_CAPACITY;
+
+	overwrite = 1;
+	if (property_list(area_populate_cb, &overwrite) == 0)
+		area->synced = stamp_ms();
+	else
+		area_sync_failed = stamp_ms();
+	overwrite = 0;
+	hybris_propcache_list(area_populate_cb, &overwrite);
+
+	area->version = PROP_AREA_VERSION;
+	__sync_synchronize();
+	area->magic = PROP_AREA_MAGIC;
+}
+
+/* private:
+ * whether a mapped area can be trusted: sizes within the mapping, and every
+ * toc entry pointing at an existing entry.
+ */
+static int area_valid_internal()
+{
+	uint32_t i, count = area->count;
+
+	if (area->magic != PROP_AREA_MAGIC || area->version != PROP_AREA_VERSION)
+		return 0;
+	if (area->capacity != PROP_AREA_CAPACITY || count > area->capacity)
+		return 0;
+
+	for (i = 0; i < count; i++)
+		if (area->toc[i] >= count)
+			return 0;
+
+	return 1;
+}
+
+/* private:
+ * the file must be ours or root's, and nobody else may write to it, or it
+ * could hand us any property value.
+ */
+static int area_file_trusted(const struct stat *st)
+{
+	if (!S_ISREG(st->st_mode))
+		return 0;
+	if (st->st_uid != geteuid() && st->st_uid != 0)
+		return 0;
+	return (st->st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+/* private:
+ * map the area, creating and populating it if we are the first user.
+ */
+static void area_init_internal()
+{
+	const char *path = getenv("HYBRIS_PROPERTY_AREA");
+	const char *ttl = getenv("HYBRIS_PROPERTY_AREA_TTL");
+	struct stat st;
+	void *map;
+	int fd;
+
+	if (path == NULL)
+		path = default_area_path;
+	if (ttl != NULL)
+		area_ttl = strtoll(ttl, NULL, 10);
+
+	fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+	if (fd >= 0) {
+		area_writable = 1;
+	} else {
+		fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+		if (fd < 0)
+			return;
+	}
+
+	flock(fd, LOCK_EX);
+
+	if (fstat(fd, &st) != 0 || !area_file_trusted(&st))
+		goto fail;
+
+	if (st.st_size < (off_t) sizeof(struct prop_area)) {
+		if (!area_writable || ftruncate(fd, sizeof(struct prop_area)) != 0)
+			goto fail;
+	}
+
+	map = mmap(NULL, sizeof(struct prop_area),
+			area_writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto fail;
+
+	area = map;
+
+	if (!area_valid_internal()) {
+		if (!area_writable) {
+			munmap(map, sizeof(struct prop_area));
+			area = NULL;
+			goto fail;
+		}
+		area_populate_internal();
+	}
+
+	flock(fd, LOCK_UN);
+	area_fd = fd;
+	return;
+
+fail:
+	area_writable = 0;
+	flock(fd, LOCK_UN);
+	close(fd);
+}
+
+static struct prop_area *area_get()
+{
+	pthread_once(&area_once, area_init_internal);
+	return area;
+}
+
+/* public:
+ * update or add a property in the area, after it was set successfully.
+ */
+void hybris_proparea_set(const char *key, const char *value)
+{
+	if (area_get() == NULL || !area_writable)
+		return;
+
+	pthread_mutex_lock(&area_mutex);
+	flock(area_fd, LOCK_EX);
+	area_set_internal(key, value, 1);
+	flock(area_fd, LOCK_UN);
+	pthread_mutex_unlock(&area_mutex);
+}
+
+/* public:
+ * refresh the area from the property list if it is older than the ttl,
+ * unless another process is at it already.
+ */
+int property_area_synced()
+{
+	int overwrite = 1;
+
+	if (area_get() == NULL)
+		return 0;
+	if (stamp_recent(area->synced))
+		return 1;
+	/* don't retry a list the service won't give for every lookup */
+	if (!area_writable || stamp_recent(area_sync_failed))
+		return 0;
+
+	if (pthread_mutex_trylock(&area_mutex) != 0)
+		return 0;
+	if (flock(area_fd, LOCK_EX | LOCK_NB) != 0) {
+		pthread_mutex_unlock(&area_mutex);
+		return 0;
+	}
+
+	if (!stamp_recent(area->synced)) {
+		if (property_list(area_populate_cb, &overwrite) == 0)
+			area->synced = stamp_ms();
+		else
+			area_sync_failed = stamp_ms();
+	}
+
+	flock(area_fd, LOCK_UN);
+	pthread_mutex_unlock(&area_mutex);
+
+	return stamp_recent(area->synced);
+}
+
+const prop_info *property_find(const char *name)
+{
+	uint32_t serial;
+	int pos;
+
+	if (name == NULL || area_get() == NULL)
+		return NULL;
+
+	do {
+		while ((serial = area->serial) & 1)
+			sched_yield();
+		__sync_synchronize();
+
+		pos = area_search_internal(name);
+		if (pos >= 0)
+			pos = area->toc[pos];
+
+		__sync_synchronize();
+	} while (serial != area->serial);
+
+	return pos >= 0 ? &area->info[pos] : NULL;
+}
+
+int property_read(const prop_info *pi, char *name, char *value)
+{
+	uint32_t serial;
+
+	if (pi == NULL)
+		return 0;
+
+	do {
+		while ((serial = pi->serial) & 1)
+			sched_yield();
+		__sync_synchronize();
+
+		if (value)
+			memcpy(value, pi->value, PROP_VALUE_MAX);
+
+		__sync_synchronize();
+	} while (serial != pi->serial);
+
+	if (value)
+		value[PROP_VALUE_MAX - 1] = '\0';
+	if (name) {
+		memcpy(name, pi->name, PROP_NAME_MAX);
+		name[PROP_NAME_MAX - 1] = '\0';
+	}
+
+	return value ? strlen(value) : 0;
+}
+
+unsigned int property_serial(const prop_info *pi)
+{
+	return pi ? pi->serial : 0;
+}
+
+unsigned int property_area_serial()
+{
+	if (area_get() == NULL)
+		return 0;
+
+	return area->serial & ~1;
+}
+
+/* Sleep until the serial of pi, or the area serial if pi is NULL, moves
+ * away from old_serial. Changes made by init are only seen once the area
+ * is refreshed. */
+unsigned int property_wait_serial(const prop_info *pi, unsigned int old_serial, int timeout)
+{
+	volatile uint32_t *serial;
+	long long deadline = timeout >= 0 ? now_ms() + timeout : -1;
+	uint32_t current;
+
+	if (area_get() == NULL) {
+		/* nothing to wait on, at least don't let callers spin */
+		if (timeout < 0 || timeout > PROPERTY_WAIT_POLL_MS)
+			timeout = PROPERTY_WAIT_POLL_MS;
+		usleep(timeout * 1000);
+		return old_serial;
+	}
+
+	serial = pi ? &((struct prop_info *) pi)->serial : &area->serial;
+
+	while ((current = *serial) == old_serial || (current & 1)) {
+		struct timespec ts, *tsp = NULL;
+		int ret;
+
+		if (deadline >= 0) {
+			long long left = deadline - now_ms();
+
+			if (left <= 0)
+				break;
+			ts.tv_sec = left / 1000;
+			ts.tv_nsec = (left % 1000) * 1000000;
+			tsp = &ts;
+		}
+
+		ret = futex_wait(serial, current, tsp);
+
+		if (ret < 0 && errno == ETIMEDOUT)
+			break;
+	}
+
+	return current & ~1;
+}
+
+/* n counts in insertion order, as in bionic */
+const prop_info *property_find_nth(unsigned n)
+{
+	if (area_get() == NULL || n >= area_count())
+		return NULL;
+
+	return &area->info[n];
+}
+
+int property_foreach(void (*propfn)(const prop_info *pi, void *cookie), void *cookie)
+{
+	unsigned i;
+
+	if (area_get() == NULL)
+		return -1;
+
+	/* entries never move, walking them in insertion order is always safe */
+	for (i = 0; i < area_count(); i++)
+		propfn(&area->info[i], cookie);
+
+	return 0;
+}
+
+// vim:ts=4:sw=4:noexpandtab
@@ -23,38 +23,116 @@
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <sys/inotify.h>
 
 #include <hybris/properties/properties.h>
 #include "properties_p.h"
 
+#define BUILD_PROP_DIR "/system"
+#define BUILD_PROP_NAME "build.prop"
+#define BUILD_PROP_PATH BUILD_PROP_DIR "/" BUILD_PROP_NAME
+
+/* how often we look for build.prop changes at most, in milliseconds */
+#define CACHE_CHECK_INTERVAL 1000
+
+/* initial number of hash slots, the table doubles when 3/4 full */
+#define CACHE_INITIAL_SIZE 512
+
 struct hybris_prop_value
 {
+	unsigned int hash;
 	char *key;
 	char *value;
 };
 
-/* surely enough for anyone */
-#define MAX_PROPS 1000
+/* open addressing hash table, with linear probing. once published, a
+ * table is never modified, only replaced by a new one. */
+struct hybris_prop_table
+{
+	unsigned int size;
+	unsigned int count;
+	struct hybris_prop_value *slots;
+	struct hybris_prop_table *next_retired;
+};
 
-/* the sorted prop array */
-static struct hybris_prop_value prop_array[MAX_PROPS];
+/* The current snapshot of build.prop, NULL if it can't be read. Readers
+ * never lock: they announce themselves in cache_readers, then load the
+ * pointer. A snapshot replaced by a reload is retired, and freed by a
+ * later reload once no reader at all is seen, as any reader coming after
+ * that point can only load the new pointer. */
+static struct hybris_prop_table *prop_snapshot;
+static struct hybris_prop_table *retired_tables;
+static volatile unsigned int cache_readers;
 
-/* the current highest index in prop_array */
-static int max_prop;
+/* serializes reloads, readers never wait for it once the cache is loaded */
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* helpers */
-static int prop_qcmp(const void *a, const void *b);
-static struct hybris_prop_value *cache_find_internal(const char *key);
-static void cache_add_internal(const char *key, const char *value);
-static void cache_repopulate_internal(FILE *f);
-static void cache_empty_internal();
-static void cache_repopulate_cmdline_internal();
-
-/* the inode/mtime of the prop cache, used for invalidation */
+static unsigned int prop_hash(const char *key);
+static struct hybris_prop_value *cache_find_internal(struct hybris_prop_table *table,
+		const char *key);
+static void cache_add_internal(struct hybris_prop_table *table, const char *key,
+		const char *value);
+static void cache_repopulate_internal(struct hybris_prop_table *table, FILE *f);
+static void cache_free_internal(struct hybris_prop_table *table);
+static void cache_repopulate_cmdline_internal(struct hybris_prop_table *table);
+static void cache_refresh();
+
+/* the inode/mtime of the prop cache, used for invalidation without inotify */
 static ino_t static_prop_inode;
 static time_t static_prop_mtime;
 
+/* watch on the build.prop directory, -1 if inotify is not available */
+static int inotify_fd = -2;
+
+/* next time we look for changes, 0 until the first load */
+static unsigned long long next_check;
+
+/* private:
+ * get the current snapshot, which stays valid until cache_release().
+ */
+static struct hybris_prop_table *cache_acquire()
+{
+	cache_refresh();
+
+	__sync_fetch_and_add(&cache_readers, 1);
+	return __atomic_load_n(&prop_snapshot, __ATOMIC_SEQ_CST);
+}
+
+static void cache_release()
+{
+	__sync_fetch_and_sub(&cache_readers, 1);
+}
+
+
+/* public:
+ * find a prop value from the file cache.
+ *
+ * the value of the given property key is copied to `value', which must
+ * hold PROP_VALUE_MAX bytes. returns the length of the value, or -1 if the
+ * property key is not found.
+ */
+int hybris_propcache_get(const char *key, char *value)
+{
+	struct hybris_prop_table *table;
+	struct hybris_prop_value *prop;
+	int ret = -1;
+
+	table = cache_acquire();
+
+	prop = cache_find_internal(table, key);
+	if (prop) {
+		strcpy(value, prop->value);
+		ret = strlen(value);
+	}
+
+	cache_release();
+	return ret;
+}
 
 /* public:
  * find a prop value from the file cache.
@@ -65,88 +143,299 @@ static time_t static_prop_mtime;
  */
 char *hybris_propcache_find(const char *key)
 {
-	struct stat st;
-	FILE *f = fopen("/system/build.prop", "r");
-	char *ret = NULL;
+	char value[PROP_VALUE_MAX];
+
+	if (hybris_propcache_get(key, value) < 0)
+		return NULL;
+
+	return strdup(value);
+}
+
+/* public:
+ * call `propfn' for every property of the file cache.
+ */
+void hybris_propcache_list(void (*propfn)(const char *key, const char *value, void *cookie),
+		void *cookie)
+{
+	struct hybris_prop_table *table;
+	unsigned int i;
+
+	table = cache_acquire();
+
+	if (table) {
+		for (i = 0; i < table->size; ++i) {
+			if (table->slots[i].key)
+				propfn(table->slots[i].key, table->slots[i].value, cookie);
+		}
+	}
+
+	cache_release();
+}
+
+static unsigned long long now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/* private:
+ * returns nonzero if inotify reported a change to build.prop. the events
+ * are for the whole directory, so that replacing the file is seen too.
+ */
+static int cache_inotify_changed_internal()
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *event;
+	int changed = 0;
+	ssize_t len;
+	char *ptr;
+
+	while ((len = read(inotify_fd, buf, sizeof(buf))) > 0) {
+		for (ptr = buf; ptr < buf + len; ptr += sizeof(*event) + event->len) {
+			event = (const struct inotify_event *) ptr;
+
+			if ((event->mask & IN_Q_OVERFLOW) ||
+				(event->len && strcmp(event->name, BUILD_PROP_NAME) == 0))
+				changed = 1;
+		}
+	}
+
+	return changed;
+}
+
+/* private:
+ * free the retired snapshots if there are no readers, with the cache lock
+ * held.
+ */
+static void cache_reclaim_internal()
+{
+	struct hybris_prop_table *old;
+
+	if (retired_tables && __atomic_load_n(&cache_readers, __ATOMIC_SEQ_CST) == 0) {
+		while (retired_tables) {
+			old = retired_tables;
+			retired_tables = old->next_retired;
+			cache_free_internal(old);
+		}
+	}
+}
+
+/* private:
+ * replace the current snapshot, with the cache lock held. the old one is
+ * retired.
+ */
+static void cache_publish_internal(struct hybris_prop_table *table)
+{
+	struct hybris_prop_table *old;
 
-	if (!f)
+	old = __atomic_exchange_n(&prop_snapshot, table, __ATOMIC_SEQ_CST);
+	if (old) {
+		old->next_retired = retired_tables;
+		retired_tables = old;
+	}
+
+	cache_reclaim_internal();
+}
+
+/* private:
+ * build a new snapshot from build.prop `f' and the kernel command line.
+ */
+static struct hybris_prop_table *cache_load_internal(FILE *f)
+{
+	struct hybris_prop_table *table = calloc(1, sizeof(*table));
+
+	if (!table)
 		return NULL;
 
-	/* before searching, we must first determine whether our cache is valid. if
-	 * it isn't, we must discard our results and re-create the cache.
-	 *
-	 * we use fstat here to avoid a race between stat and something else
+	cache_repopulate_internal(table, f);
+	cache_repopulate_cmdline_internal(table);
+	return table;
+}
+
+/* private:
+ * make sure the snapshot matches build.prop, loading a new one if needed,
+ * with the cache lock held. see cache_refresh().
+ */
+static void cache_refresh_internal()
+{
+	struct hybris_prop_table *table;
+	struct stat st;
+	FILE *f;
+
+	if (inotify_fd == -2) {
+		/* watch before reading, so that no change can be missed */
+		inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (inotify_fd >= 0 && inotify_add_watch(inotify_fd, BUILD_PROP_DIR,
+				IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_ATTRIB) < 0) {
+			close(inotify_fd);
+			inotify_fd = -1;
+		}
+	}
+
+	/* still a good time to free what the last reload retired */
+	cache_reclaim_internal();
+
+	if (prop_snapshot && inotify_fd >= 0 && !cache_inotify_changed_internal())
+		return;
+
+	f = fopen(BUILD_PROP_PATH, "r");
+	if (!f) {
+		cache_publish_internal(NULL);
+		return;
+	}
+
+	/* we use fstat here to avoid a race between stat and something else
 	 * touching the file.
 	 */
 	if (fstat(fileno(f), &st) != 0) {
 		perror("cache_find can't stat build.prop");
-		goto out;
+		fclose(f);
+		return;
 	}
 
-	/* TODO: is there any better way to detect changes? */
-	if (static_prop_inode != st.st_ino ||
+	if (!prop_snapshot || inotify_fd >= 0 ||
+		static_prop_inode != st.st_ino ||
 		static_prop_mtime != st.st_mtime) {
-		static_prop_inode = st.st_ino;
-		static_prop_mtime = st.st_mtime;
+		/* cache is stale. build a fresh one on the side. */
+		table = cache_load_internal(f);
+		if (table) {
+			static_prop_inode = st.st_ino;
+			static_prop_mtime = st.st_mtime;
+			cache_publish_internal(table);
+		}
+	}
 
-		/* cache is stale. fill it back up with fresh data first. */
-		cache_empty_internal();
-		cache_repopulate_internal(f);
-		cache_repopulate_cmdline_internal();
+	fclose(f);
+}
 
-		/* sort by keys */
-		qsort(prop_array, max_prop, sizeof(struct hybris_prop_value), prop_qcmp);
-	}
+/* private:
+ * make sure the cache matches build.prop. this is checked at most every
+ * CACHE_CHECK_INTERVAL, through inotify when available, otherwise by
+ * comparing the inode and mtime of the file.
+ *
+ * only the very first load makes readers wait: later on, whoever finds the
+ * lock taken keeps using the current snapshot.
+ */
+static void cache_refresh()
+{
+	unsigned long long check = __atomic_load_n(&next_check, __ATOMIC_ACQUIRE);
+	unsigned long long now = now_ms();
 
-	/* then look up the key and do a copy if we get a result */
-	struct hybris_prop_value *prop = cache_find_internal(key);
-	if (prop)
-		ret = strdup(prop->value);
+	if (now < check)
+		return;
 
-out:
-	fclose(f);
-	return ret;
+	if (check == 0)
+		pthread_mutex_lock(&cache_mutex);
+	else if (pthread_mutex_trylock(&cache_mutex) != 0)
+		return;
+
+	/* someone else may have been faster */
+	if (now_ms() >= next_check) {
+		cache_refresh_internal();
+		__atomic_store_n(&next_check, now_ms() + CACHE_CHECK_INTERVAL, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&cache_mutex);
 }
 
 /* private:
- * empties the prop cache, ready for repopulation
+ * frees a snapshot and all its entries
  */
-static void cache_empty_internal()
+static void cache_free_internal(struct hybris_prop_table *table)
 {
-	int i;
-	for (i = 0; i < max_prop; ++i) {
-		free(prop_array[i].key);
-		free(prop_array[i].value);
+	unsigned int i;
+
+	for (i = 0; i < table->size; ++i) {
+		free(table->slots[i].key);
+		free(table->slots[i].value);
 	}
 
-	max_prop = 0;
+	free(table->slots);
+	free(table);
 }
 
 /* private:
- * compares two hybris_prop_value by key, so as to maintain a qsorted array of
- * props, and search the array.
+ * hash function for prop keys (djb2)
  */
-static int prop_qcmp(const void *a, const void *b)
+static unsigned int prop_hash(const char *key)
 {
-	struct hybris_prop_value *aa = (struct hybris_prop_value *)a;
-	struct hybris_prop_value *bb = (struct hybris_prop_value *)b;
+	unsigned int hash = 5381;
 
-	return strcmp(aa->key, bb->key);
+	while (*key)
+		hash = hash * 33 + (unsigned char)*key++;
+
+	return hash;
 }
 
 /* private:
  * find a given key in the in-memory prop cache.
  *
- * returns the value of the given property key, or NULL if the property is not
- * found. Note that this does not pass ownership of the hybris_prop_value or the
- * data inside it.
+ * returns the slot holding the given property key, or NULL if the property
+ * is not found. Note that this does not pass ownership of the
+ * hybris_prop_value or the data inside it.
+ */
+static struct hybris_prop_value *cache_find_internal(struct hybris_prop_table *table,
+		const char *key)
+{
+	unsigned int hash = prop_hash(key);
+	unsigned int i;
+
+	if (!table || table->size == 0)
+		return NULL;
+
+	for (i = hash & (table->size - 1); table->slots[i].key;
+			i = (i + 1) & (table->size - 1)) {
+		if (table->slots[i].hash == hash && strcmp(table->slots[i].key, key) == 0)
+			return &table->slots[i];
+	}
+
+	return NULL;
+}
+
+/* private:
+ * place an entry in the first free slot for its hash
+ */
+static void cache_insert_internal(struct hybris_prop_table *table,
+		const struct hybris_prop_value *prop)
+{
+	unsigned int i;
+
+	for (i = prop->hash & (table->size - 1); table->slots[i].key;
+			i = (i + 1) & (table->size - 1))
+		;
+
+	table->slots[i] = *prop;
+	table->count++;
+}
+
+/* private:
+ * double the size of the hash table, or allocate the initial one.
+ *
+ * returns 0 on success, -1 if out of memory.
  */
-static struct hybris_prop_value *cache_find_internal(const char *key)
+static int cache_grow_internal(struct hybris_prop_table *table)
 {
-	struct hybris_prop_value prop_key;
-	prop_key.key = (char*)key;
+	struct hybris_prop_table grown;
+	unsigned int i;
+
+	grown.size = table->size ? table->size * 2 : CACHE_INITIAL_SIZE;
+	grown.count = 0;
+	grown.slots = calloc(grown.size, sizeof(struct hybris_prop_value));
+	if (!grown.slots)
+		return -1;
+
+	for (i = 0; i < table->size; ++i) {
+		if (table->slots[i].key)
+			cache_insert_internal(&grown, &table->slots[i]);
+	}
 
-	return bsearch(&prop_key, prop_array, max_prop, sizeof(struct hybris_prop_value), prop_qcmp);
+	free(table->slots);
+	table->size = grown.size;
+	table->count = grown.count;
+	table->slots = grown.slots;
+	return 0;
 }
 
 /* private:
@@ -154,29 +443,41 @@ static struct hybris_prop_value *cache_find_internal(const char *key)
  *
  * both `key' and `value' are copied from the caller.
  */
-static void cache_add_internal(const char *key, const char *value)
+static void cache_add_internal(struct hybris_prop_table *table, const char *key,
+		const char *value)
 {
+	struct hybris_prop_value prop;
+
 	/* Skip values that can be bigger than value max */
 	if (strlen(value) >= PROP_VALUE_MAX -1)
 		return;
 
 	/* preserve current behavior of first prop key => match */
-	if (cache_find_internal(key))
+	if (cache_find_internal(table, key))
 		return;
 
-	prop_array[max_prop].key = strdup(key);
-	prop_array[max_prop++].value = strdup(value);
+	if ((table->count + 1) * 4 > table->size * 3 &&
+		cache_grow_internal(table) != 0) {
+		fprintf(stderr, "libhybris: out of memory, dropping prop %s\n", key);
+		return;
+	}
 
-	if (max_prop >= MAX_PROPS) {
-		fprintf(stderr, "libhybris: ran out of props, increase MAX_PROPS");
-		exit(1);
+	prop.hash = prop_hash(key);
+	prop.key = strdup(key);
+	prop.value = strdup(value);
+	if (!prop.key || !prop.value) {
+		free(prop.key);
+		free(prop.value);
+		return;
 	}
+
+	cache_insert_internal(table, &prop);
 }
 
 /* private:
  * repopulates the prop cache from a given file `f'.
  */
-static void cache_repopulate_internal(FILE *f)
+static void cache_repopulate_internal(struct hybris_prop_table *table, FILE *f)
 {
 	char buf[1024];
 	char *mkey, *value;
@@ -196,14 +497,14 @@ static void cache_repopulate_internal(FILE *f)
 		if (!value)
 			continue;
 
-		cache_add_internal(mkey, value);
+		cache_add_internal(table, mkey, value);
 	}
 }
 
 /* private:
  * repopulate the prop cache from /proc/cmdline
  */
-static void cache_repopulate_cmdline_internal()
+static void cache_repopulate_cmdline_internal(struct hybris_prop_table *table)
 {
 	/* Find a key value from the kernel command line, which is parsed
 	 * by Android at init (on an Android working system) */
@@ -246,7 +547,7 @@ static void cache_repopulate_cmdline_internal()
 			char prop[PROP_NAME_MAX];
 			snprintf(prop, sizeof(prop) -1, "ro.%s", boot_prop_name);
 
-			cache_add_internal(prop, value);
+			cache_add_internal(table, prop, value);
 		}
 	}
 }
@@ -34,14 +34,29 @@
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <poll.h>
+#include <time.h>
 
 #include <hybris/properties/properties.h>
 #include "properties_p.h"
 
 
-static const char property_service_socket[] = "/dev/socket/" PROP_SERVICE_NAME;
+static const char default_property_service_socket[] = "/dev/socket/" PROP_SERVICE_NAME;
 static int send_prop_msg_no_reply = 0;
 
+/* HYBRIS_PROPERTY_SOCKET points to another property service, e.g. the
+ * stand-in server of hybris-propbench */
+static const char *property_service_socket()
+{
+	static const char *path = NULL;
+
+	if (path == NULL) {
+		const char *env = getenv("HYBRIS_PROPERTY_SOCKET");
+		path = env ? env : default_property_service_socket;
+	}
+
+	return path;
+}
+
 /* Get/Set a property from the Android Init property socket */
 static int send_prop_msg(prop_msg_t *msg,
 		void (*propfn)(const char *, const char *, void *),
@@ -72,8 +87,12 @@ static int send_prop_msg(prop_msg_t *msg,
 	}
 
 	memset(&addr, 0, sizeof(addr));
-	namelen = strlen(property_service_socket);
-	strncpy(addr.addr.sun_path, property_service_socket,
+	namelen = strlen(property_service_socket());
+	if (namelen >= sizeof(addr.addr.sun_path)) {
+		close(s);
+		return result;
+	}
+	strncpy(addr.addr.sun_path, property_service_socket(),
 			sizeof(addr.addr.sun_path));
 	addr.addr.sun_family = AF_LOCAL;
 	alen = namelen + offsetof(struct sockaddr_un, sun_path) + 1;
@@ -148,6 +167,8 @@ static int property_get_socket(const char *key, char *value, const char *default
 		err = send_prop_msg(&msg, NULL, NULL);
 		if (err < 0)
 			return err;
+
+		hybris_runtime_cache_put(key, msg.value);
 	}
 
 	/* In case it's null, just use the default */
@@ -163,20 +184,22 @@ static int property_get_socket(const char *key, char *value, const char *default
 
 int property_get(const char *key, char *value, const char *default_value)
 {
-	char *ret = NULL;
-
 	if ((key) && (strlen(key) >= PROP_NAME_MAX -1)) return -1;
 	if (value == NULL) return -1;
 
+	if (key && hybris_runtime_cache_get(key, value)) {
+		if ((strlen(value) == 0) && (default_value)) {
+			if (strlen(default_value) >= PROP_VALUE_MAX -1) return -1;
+			strcpy(value, default_value);
+		}
+		return strlen(value);
+	}
+
 	if (property_get_socket(key, value, default_value) == 0)
 		return strlen(value);
 
 	/* In case the socket is not available, search the property file cache by hand */
-	ret = hybris_propcache_find(key);
-
-	if (ret) {
-		strcpy(value, ret);
-		free(ret);
+	if (key && hybris_propcache_get(key, value) >= 0) {
 		return strlen(value);
 	} else if (default_value != NULL) {
 		strcpy(value, default_value);
@@ -188,6 +211,124 @@ int property_get(const char *key, char *value, const char *default_value)
 	return 0;
 }
 
+struct property_batch {
+	const char **keys;
+	char **values;
+	char *found;
+	int count;
+};
+
+static void property_batch_cb(const char *key, const char *value, void *cookie)
+{
+	struct property_batch *batch = cookie;
+	int i;
+
+	hybris_runtime_cache_put(key, value);
+
+	for (i = 0; i < batch->count; i++) {
+		if (!batch->found[i] && strcmp(batch->keys[i], key) == 0) {
+			strncpy(batch->values[i], value, PROP_VALUE_MAX - 1);
+			batch->values[i][PROP_VALUE_MAX - 1] = '\0';
+			batch->found[i] = 1;
+		}
+	}
+}
+
+/* Look up several properties with a single LISTPROP round trip for all the
+ * ones the cache can't answer, instead of one connection each */
+int property_get_many(const char **keys, char **values, int count)
+{
+	struct property_batch batch;
+	int i, misses = 0, set = 0;
+
+	if (keys == NULL || values == NULL || count < 0) return -1;
+
+	for (i = 0; i < count; i++) {
+		if (keys[i] == NULL || values[i] == NULL) return -1;
+		if (strlen(keys[i]) >= PROP_NAME_MAX -1) return -1;
+	}
+
+	batch.keys = keys;
+	batch.values = values;
+	batch.count = count;
+	batch.found = calloc(count ? count : 1, 1);
+	if (batch.found == NULL)
+		return -1;
+
+	for (i = 0; i < count; i++) {
+		if (hybris_runtime_cache_get(keys[i], values[i]))
+			batch.found[i] = 1;
+		else
+			misses++;
+	}
+
+	if (misses > 1 && property_list(property_batch_cb, &batch) == 0) {
+		/* whatever the list didn't mention is unset */
+		hybris_runtime_cache_complete();
+		for (i = 0; i < count; i++) {
+			if (!batch.found[i]) {
+				values[i][0] = '\0';
+				batch.found[i] = 1;
+			}
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!batch.found[i])
+			property_get(keys[i], values[i], "");
+		if (values[i][0])
+			set++;
+	}
+
+	free(batch.found);
+	return set;
+}
+
+static long long property_now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* Init can't push changes to us, so sleep on the property area, which wakes
+ * us up as soon as a libhybris process sets something, and check again at
+ * least every PROPERTY_WAIT_POLL_MS for anything else */
+int property_wait(const char *key, const char *old_value, int timeout)
+{
+	char value[PROP_VALUE_MAX];
+	long long deadline = -1;
+	unsigned int serial;
+	int wait;
+
+	if (key == NULL || strlen(key) >= PROP_NAME_MAX -1) return -1;
+	if (old_value == NULL) old_value = "";
+
+	if (timeout >= 0)
+		deadline = property_now_ms() + timeout;
+
+	for (;;) {
+		serial = property_area_serial();
+
+		property_get(key, value, "");
+		if (strcmp(value, old_value) != 0)
+			return 0;
+
+		wait = PROPERTY_WAIT_POLL_MS;
+		if (deadline >= 0) {
+			long long left = deadline - property_now_ms();
+
+			if (left <= 0)
+				return -ETIMEDOUT;
+			if (left < wait)
+				wait = left;
+		}
+
+		property_wait_serial(NULL, serial, wait);
+	}
+}
+
 int property_set(const char *key, const char *value)
 {
 	int err;
@@ -204,10 +345,13 @@ int property_set(const char *key, const char *value)
 	strncpy(msg.value, value, sizeof(msg.value));
 
 	err = send_prop_msg(&msg, NULL, NULL);
+	hybris_runtime_cache_invalidate(key);
 	if (err < 0) {
 		return err;
 	}
 
+	hybris_proparea_set(key, value);
+
 	return 0;
 }
 
@@ -18,6 +18,19 @@
 #ifndef HYBRIS_PROPERTIES
 #define HYBRIS_PROPERTIES
 
+int hybris_propcache_get(const char *key, char *value);
 char *hybris_propcache_find(const char *key);
+void hybris_propcache_list(void (*propfn)(const char *key, const char *value, void *cookie),
+		void *cookie);
+
+/* Per-process cache of property service answers */
+int hybris_runtime_cache_enabled();
+int hybris_runtime_cache_get(const char *key, char *value);
+void hybris_runtime_cache_put(const char *key, const char *value);
+void hybris_runtime_cache_invalidate(const char *key);
+void hybris_runtime_cache_complete();
+
+/* Update or add a property in the shared property area, if writable */
+void hybris_proparea_set(const char *key, const char *value);
 
 #endif
@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <hybris/properties/properties.h>
+#include "properties_p.h"
+
+/* Per-process cache of the answers of the property service.
+ *
+ * HYBRIS_PROPERTY_CACHE_TTL sets for how many milliseconds a value may be
+ * reused (default 0, no caching). With HYBRIS_PROPERTY_CACHE_RO=1, ro.*
+ * properties are kept forever once set. That is off by default, since only
+ * Android's init makes ro.* write-once and other property services don't
+ * have to. Unset properties are only cached for the TTL, as they may show
+ * up later.
+ *
+ * With HYBRIS_PROPERTY_PREFETCH=1 the whole property list is fetched over
+ * a single connection when the cache is first used. */
+
+#define RUNTIME_CACHE_BUCKETS 256
+
+#ifdef CLOCK_MONOTONIC_COARSE
+#define RUNTIME_CACHE_CLOCK CLOCK_MONOTONIC_COARSE
+#else
+#define RUNTIME_CACHE_CLOCK CLOCK_MONOTONIC
+#endif
+
+struct runtime_cache_entry {
+	struct runtime_cache_entry *next;
+	char key[PROP_NAME_MAX];
+	char value[PROP_VALUE_MAX];
+	int permanent;
+	unsigned long long expires;
+};
+
+static struct runtime_cache_entry *buckets[RUNTIME_CACHE_BUCKETS];
+static pthread_mutex_t runtime_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t runtime_cache_once = PTHREAD_ONCE_INIT;
+
+static unsigned long long cache_ttl = 0;
+static int cache_ro = 0;
+
+/* until then, a property missing from the cache is known to be unset */
+static unsigned long long complete_until = 0;
+
+static unsigned long cache_hits = 0;
+static unsigned long cache_misses = 0;
+
+static unsigned long long now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(RUNTIME_CACHE_CLOCK, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static unsigned int hash_key(const char *key)
+{
+	unsigned int hash = 5381;
+
+	while (*key)
+		hash = hash * 33 + (unsigned char) *key++;
+
+	return hash % RUNTIME_CACHE_BUCKETS;
+}
+
+static struct runtime_cache_entry *find_internal(const char *key)
+{
+	struct runtime_cache_entry *entry;
+
+	for (entry = buckets[hash_key(key)]; entry != NULL; entry = entry->next) {
+		if (strcmp(entry->key, key) == 0)
+			return entry;
+	}
+
+	return NULL;
+}
+
+/* private:
+ * store a value, with the cache lock held.
+ */
+static void put_internal(const char *key, const char *value)
+{
+	struct runtime_cache_entry *entry;
+	int permanent;
+
+	permanent = cache_ro && value[0] && strncmp(key, "ro.", 3) == 0;
+	if (!permanent && cache_ttl == 0)
+		return;
+
+	entry = find_internal(key);
+	if (entry == NULL) {
+		entry = calloc(1, sizeof(*entry));
+		if (entry == NULL)
+			return;
+
+		strncpy(entry->key, key, PROP_NAME_MAX - 1);
+		entry->next = buckets[hash_key(key)];
+		buckets[hash_key(key)] = entry;
+	}
+
+	strncpy(entry->value, value, PROP_VALUE_MAX - 1);
+	entry->permanent = permanent;
+	entry->expires = now_ms() + cache_ttl;
+}
+
+static void prefetch_cb(const char *key, const char *value, void *cookie)
+{
+	put_internal(key, value);
+}
+
+static void runtime_cache_init_internal()
+{
+	const char *env = getenv("HYBRIS_PROPERTY_CACHE_TTL");
+
+	if (env)
+		cache_ttl = strtoull(env, NULL, 10);
+
+	env = getenv("HYBRIS_PROPERTY_CACHE_RO");
+	if (env && strcmp(env, "1") == 0)
+		cache_ro = 1;
+
+	env = getenv("HYBRIS_PROPERTY_PREFETCH");
+	if (env && strcmp(env, "1") == 0 && (cache_ttl > 0 || cache_ro)) {
+		pthread_mutex_lock(&runtime_cache_mutex);
+		if (property_list(prefetch_cb, NULL) == 0 && cache_ttl > 0)
+			complete_until = now_ms() + cache_ttl;
+		pthread_mutex_unlock(&runtime_cache_mutex);
+	}
+}
+
+/* whether the cache could hold anything at all */
+int hybris_runtime_cache_enabled()
+{
+	pthread_once(&runtime_cache_once, runtime_cache_init_internal);
+	return cache_ttl > 0 || cache_ro;
+}
+
+/* returns 1 and fills `value' (empty if the property is unset) on a hit */
+int hybris_runtime_cache_get(const char *key, char *value)
+{
+	struct runtime_cache_entry *entry;
+	int hit = 0;
+
+	if (!hybris_runtime_cache_enabled())
+		return 0;
+
+	pthread_mutex_lock(&runtime_cache_mutex);
+	entry = find_internal(key);
+	if (entry && (entry->permanent || now_ms() < entry->expires)) {
+		strcpy(value, entry->value);
+		hit = 1;
+	} else if (entry == NULL && now_ms() < complete_until) {
+		value[0] = '\0';
+		hit = 1;
+	}
+	pthread_mutex_unlock(&runtime_cache_mutex);
+
+	__sync_fetch_and_add(hit ? &cache_hits : &cache_misses, 1);
+	return hit;
+}
+
+void hybris_runtime_cache_put(const char *key, const char *value)
+{
+	if (!hybris_runtime_cache_enabled())
+		return;
+
+	pthread_mutex_lock(&runtime_cache_mutex);
+	put_internal(key, value);
+	pthread_mutex_unlock(&runtime_cache_mutex);
+}
+
+/* the whole property list was just fetched, see complete_until */
+void hybris_runtime_cache_complete()
+{
+	if (!hybris_runtime_cache_enabled() || cache_ttl == 0)
+		return;
+
+	pthread_mutex_lock(&runtime_cache_mutex);
+	complete_until = now_ms() + cache_ttl;
+	pthread_mutex_unlock(&runtime_cache_mutex);
+}
+
+void hybris_runtime_cache_invalidate(const char *key)
+{
+	struct runtime_cache_entry *entry;
+
+	if (!hybris_runtime_cache_enabled())
+		return;
+
+	pthread_mutex_lock(&runtime_cache_mutex);
+	entry = find_internal(key);
+	if (entry) {
+		entry->permanent = 0;
+		entry->expires = 0;
+	}
+	/* the key may be new */
+	complete_until = 0;
+	pthread_mutex_unlock(&runtime_cache_mutex);
+}
+
+void property_cache_stats(unsigned long *hits, unsigned long *misses)
+{
+	if (hits)
+		*hits = cache_hits;
+	if (misses)
+		*misses = cache_misses;
+}
+
+// vim:ts=4:sw=4:noexpandtab
@@ -1,5 +1,5 @@
 /**
- * test_egl_configs: List available EGL configurations
+ * test_egl_configs: List available EGL configurations, and time config queries
  * Copyright (c) 2013 Thomas Perl <m@thp.io>
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
@@ -20,6 +20,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
@@ -74,6 +75,55 @@ ATTRIB(EGLint attribute)
 #define END_DECODE_BITFIELD(x) TEST_LOG(")\n")
 
 
+static double
+now_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/**
+ * Times what toolkits do for each new window: pick a config, then look at
+ * the attributes of the candidates. Compare with HYBRIS_EGL_CONFIG_CACHE=0.
+ **/
+static void
+benchmark(EGLConfig *configs, EGLint num_config, int rounds)
+{
+    static const EGLint attribs[] = {
+        EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+        EGL_NONE
+    };
+    double start, choose = 0, attrib = 0;
+    EGLConfig chosen[16];
+    EGLint num_chosen, value;
+    int round, i;
+
+    for (round = 0; round < rounds; round++) {
+        start = now_us();
+        eglChooseConfig(display, attribs, chosen, 16, &num_chosen);
+        choose += now_us() - start;
+
+        start = now_us();
+        for (i = 0; i < num_config; i++) {
+            eglGetConfigAttrib(display, configs[i], EGL_RED_SIZE, &value);
+            eglGetConfigAttrib(display, configs[i], EGL_ALPHA_SIZE, &value);
+            eglGetConfigAttrib(display, configs[i], EGL_DEPTH_SIZE, &value);
+            eglGetConfigAttrib(display, configs[i], EGL_SAMPLES, &value);
+            eglGetConfigAttrib(display, configs[i], EGL_NATIVE_VISUAL_ID, &value);
+        }
+        attrib += now_us() - start;
+    }
+
+    TEST_LOG("===== Timing (%d rounds) =====\n", rounds);
+    TEST_LOG("  eglChooseConfig: %.1f us per call\n", choose / rounds);
+    TEST_LOG("  eglGetConfigAttrib: %.2f us per call\n",
+            attrib / rounds / (num_config * 5));
+}
+
 /**
  * For reference, the values tested below have been obtained from:
  * http://www.khronos.org/registry/egl/sdk/docs/man/xhtml/eglGetConfigAttrib.html
@@ -89,6 +139,7 @@ main(int argc, char *argv[])
     EGLint num_config_result;
     EGLConfig *configs;
     EGLint value;
+    int rounds = argc > 1 ? atoi(argv[1]) : 10;
     int i;
 
     TEST_LOG("Starting test (EGL_PLATFORM=%s)\n", getenv("EGL_PLATFORM"));
@@ -209,6 +260,9 @@ main(int argc, char *argv[])
         TEST_LOG("\n\n");
     }
 
+    if (rounds > 0 && num_config_result > 0)
+        benchmark(configs, num_config_result, rounds);
+
     free(configs);
 
     result = eglTerminate(display);
@@ -0,0 +1,146 @@
+/**
+ * test_egl_procaddress: Time eglGetProcAddress() lookups, as done at startup
+ * Copyright (c) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+
+/**
+ * Resolves a toolkit-sized set of names the way Qt or a GL dispatcher does
+ * at startup, then again, as done per context. Run once as is and once with
+ * HYBRIS_EGL_PROC_CACHE=0 to compare with and without the cache.
+ *
+ * Usage: test_egl_procaddress [rounds]
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+
+static const char *names[] = {
+    "eglCreateImageKHR", "eglDestroyImageKHR", "eglCreateSyncKHR",
+    "eglDestroySyncKHR", "eglClientWaitSyncKHR", "eglGetSyncAttribKHR",
+    "eglLockSurfaceKHR", "eglUnlockSurfaceKHR", "eglSwapBuffersWithDamageKHR",
+    "eglSetDamageRegionKHR", "eglBindWaylandDisplayWL", "eglUnbindWaylandDisplayWL",
+    "eglQueryWaylandBufferWL", "eglHybrisCreateNativeBuffer",
+    "eglHybrisLockNativeBuffer", "eglHybrisUnlockNativeBuffer",
+    "eglHybrisReleaseNativeBuffer", "eglHybrisCreateRemoteBuffer",
+    "eglHybrisGetNativeBufferInfo", "eglHybrisSerializeNativeBuffer",
+    "glEGLImageTargetTexture2DOES", "glEGLImageTargetRenderbufferStorageOES",
+    "glActiveTexture", "glAttachShader", "glBindAttribLocation", "glBindBuffer",
+    "glBindFramebuffer", "glBindRenderbuffer", "glBindTexture", "glBlendColor",
+    "glBlendEquation", "glBlendEquationSeparate", "glBlendFunc",
+    "glBlendFuncSeparate", "glBufferData", "glBufferSubData",
+    "glCheckFramebufferStatus", "glClear", "glClearColor", "glClearDepthf",
+    "glClearStencil", "glColorMask", "glCompileShader", "glCompressedTexImage2D",
+    "glCompressedTexSubImage2D", "glCopyTexImage2D", "glCopyTexSubImage2D",
+    "glCreateProgram", "glCreateShader", "glCullFace", "glDeleteBuffers",
+    "glDeleteFramebuffers", "glDeleteProgram", "glDeleteRenderbuffers",
+    "glDeleteShader", "glDeleteTextures", "glDepthFunc", "glDepthMask",
+    "glDepthRangef", "glDetachShader", "glDisable", "glDisableVertexAttribArray",
+    "glDrawArrays", "glDrawElements", "glEnable", "glEnableVertexAttribArray",
+    "glFinish", "glFlush", "glFramebufferRenderbuffer", "glFramebufferTexture2D",
+    "glFrontFace", "glGenBuffers", "glGenerateMipmap", "glGenFramebuffers",
+    "glGenRenderbuffers", "glGenTextures", "glGetActiveAttrib",
+    "glGetActiveUniform", "glGetAttachedShaders", "glGetAttribLocation",
+    "glGetBooleanv", "glGetBufferParameteriv", "glGetError", "glGetFloatv",
+    "glGetFramebufferAttachmentParameteriv", "glGetIntegerv", "glGetProgramiv",
+    "glGetProgramInfoLog", "glGetRenderbufferParameteriv", "glGetShaderiv",
+    "glGetShaderInfoLog", "glGetShaderPrecisionFormat", "glGetShaderSource",
+    "glGetString", "glGetTexParameterfv", "glGetTexParameteriv",
+    "glGetUniformfv", "glGetUniformiv", "glGetUniformLocation",
+    "glGetVertexAttribfv", "glGetVertexAttribiv", "glGetVertexAttribPointerv",
+    "glHint", "glIsBuffer", "glIsEnabled", "glIsFramebuffer", "glIsProgram",
+    "glIsRenderbuffer", "glIsShader", "glIsTexture", "glLineWidth",
+    "glLinkProgram", "glPixelStorei", "glPolygonOffset", "glReadPixels",
+    "glReleaseShaderCompiler", "glRenderbufferStorage", "glSampleCoverage",
+    "glScissor", "glShaderBinary", "glShaderSource", "glStencilFunc",
+    "glStencilFuncSeparate", "glStencilMask", "glStencilMaskSeparate",
+    "glStencilOp", "glStencilOpSeparate", "glTexImage2D", "glTexParameterf",
+    "glTexParameterfv", "glTexParameteri", "glTexParameteriv", "glTexSubImage2D",
+    "glUniform1f", "glUniform1fv", "glUniform1i", "glUniform1iv", "glUniform2f",
+    "glUniform2fv", "glUniform2i", "glUniform2iv", "glUniform3f", "glUniform3fv",
+    "glUniform3i", "glUniform3iv", "glUniform4f", "glUniform4fv", "glUniform4i",
+    "glUniform4iv", "glUniformMatrix2fv", "glUniformMatrix3fv",
+    "glUniformMatrix4fv", "glUseProgram", "glValidateProgram",
+    "glVertexAttrib1f", "glVertexAttrib2f", "glVertexAttrib3f",
+    "glVertexAttrib4f", "glVertexAttribPointer", "glViewport",
+    "glMapBufferOES", "glUnmapBufferOES", "glGetBufferPointervOES",
+    "glBindVertexArrayOES", "glDeleteVertexArraysOES", "glGenVertexArraysOES",
+    "glDiscardFramebufferEXT", "glRenderbufferStorageMultisampleIMG",
+    "glFramebufferTexture2DMultisampleIMG", "glGetProgramBinaryOES",
+    "glProgramBinaryOES", "glTexImage3DOES", "glDoesNotExistHYBRIS",
+};
+
+#define NAME_COUNT (sizeof(names) / sizeof(names[0]))
+
+
+static double
+now_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static double
+resolve_all(int *found)
+{
+    double start = now_us();
+    unsigned int i;
+
+    *found = 0;
+    for (i = 0; i < NAME_COUNT; i++) {
+        if (eglGetProcAddress(names[i]) != NULL)
+            (*found)++;
+    }
+
+    return now_us() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 100;
+    double first, total = 0;
+    EGLDisplay display;
+    int found, i;
+
+    /* keep loading the driver out of the first round */
+    display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+        fprintf(stderr, "Can't initialize EGL\n");
+        return 1;
+    }
+
+    first = resolve_all(&found);
+    printf("%d names, %d resolved\n", (int) NAME_COUNT, found);
+    printf("first round:  %10.1f us (%.2f us per name)\n", first, first / NAME_COUNT);
+
+    for (i = 0; i < rounds; i++) {
+        total += resolve_all(&found);
+    }
+
+    if (rounds > 0) {
+        printf("later rounds: %10.1f us (%.2f us per name), %d rounds\n",
+                total / rounds, total / rounds / NAME_COUNT, rounds);
+    }
+
+    eglTerminate(display);
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Measures the throughput of the malloc/free hooks handed to Android code,
+ * compared to calling glibc directly. Run it once as is and once with
+ * HYBRIS_MALLOC_LIBRARY set to compare allocator backends:
+ *
+ *   test_hooks_malloc [threads] [iterations]
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define SLOTS 256
+
+extern void *get_hooked_symbol(char *sym);
+
+static void *(*bench_malloc)(size_t size);
+static void (*bench_free)(void *ptr);
+static int iterations = 1000000;
+
+static void *bench_thread(void *arg)
+{
+	void *slots[SLOTS] = { 0 };
+	unsigned int seed = (unsigned int) (size_t) arg;
+	int i;
+
+	for (i = 0; i < iterations; i++) {
+		int slot = rand_r(&seed) % SLOTS;
+
+		/* Mostly small sizes, like Android's native code does */
+		size_t size = 8 << (rand_r(&seed) % 8);
+
+		bench_free(slots[slot]);
+		slots[slot] = bench_malloc(size);
+		assert(slots[slot] != NULL);
+	}
+
+	for (i = 0; i < SLOTS; i++)
+		bench_free(slots[i]);
+
+	return NULL;
+}
+
+static double run(const char *name, int threads)
+{
+	pthread_t tids[threads];
+	struct timespec start, end;
+	double elapsed, ops;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < threads; i++)
+		pthread_create(&tids[i], NULL, bench_thread, (void *) (size_t) (i + 1));
+	for (i = 0; i < threads; i++)
+		pthread_join(tids[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	ops = (double) threads * iterations / elapsed;
+
+	printf("%-8s %2d threads: %8.3f s, %12.0f ops/s\n", name, threads, elapsed, ops);
+	return ops;
+}
+
+int main(int argc, char **argv)
+{
+	int threads = 4;
+	double glibc, hooked;
+
+	if (argc > 1)
+		threads = atoi(argv[1]);
+	if (argc > 2)
+		iterations = atoi(argv[2]);
+	assert(threads > 0 && iterations > 0);
+
+	bench_malloc = malloc;
+	bench_free = free;
+	glibc = run("glibc", threads);
+
+	bench_malloc = get_hooked_symbol("malloc");
+	bench_free = get_hooked_symbol("free");
+	assert(bench_malloc != NULL && bench_free != NULL);
+	hooked = run("hooked", threads);
+
+	printf("hooked/glibc: %.2f\n", hooked / glibc);
+
+	return 0;
+}
+
+// vim:ts=4:sw=4:noexpandtab
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Property lookup latency:
+ *
+ *   test_properties [key] [iterations]
+ *
+ * Without a property service, the property_get() numbers are those of the
+ * build.prop cache.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <hybris/properties/properties.h>
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double start, int iterations)
+{
+	double elapsed = now() - start;
+
+	printf("%-24s %10.3f us/lookup\n", name, elapsed * 1e6 / iterations);
+}
+
+int main(int argc, char **argv)
+{
+	const char *key = "ro.build.version.sdk";
+	char value[PROP_VALUE_MAX];
+	char area_value[PROP_VALUE_MAX];
+	const prop_info *pi;
+	unsigned long hits, misses;
+	int iterations = 10000;
+	double start;
+	int i;
+
+	if (argc > 1)
+		key = argv[1];
+	if (argc > 2)
+		iterations = atoi(argv[2]);
+	assert(iterations > 0);
+
+	property_get(key, value, "");
+	printf("%s = '%s'\n", key, value);
+
+	start = now();
+	for (i = 0; i < iterations; i++)
+		property_get(key, value, "");
+	report("property_get", start, iterations);
+
+	property_cache_stats(&hits, &misses);
+	printf("property cache: %lu hits, %lu misses\n", hits, misses);
+
+	pi = property_find(key);
+	if (pi == NULL) {
+		printf("%s not in the property area\n", key);
+		return 0;
+	}
+
+	property_read(pi, NULL, area_value);
+	if (property_area_synced())
+		assert(strcmp(value, area_value) == 0);
+	else
+		printf("property area not in sync, values not compared\n");
+
+	start = now();
+	for (i = 0; i < iterations; i++)
+		property_read(property_find(key), NULL, area_value);
+	report("property_find+read", start, iterations);
+
+	start = now();
+	for (i = 0; i < iterations; i++)
+		property_read(pi, NULL, area_value);
+	report("property_read", start, iterations);
+
+	return 0;
+}
+
+// vim:ts=4:sw=4:noexpandtab
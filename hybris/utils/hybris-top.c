@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Live view of the metrics libhybris processes keep in
+ * HYBRIS_METRICS_DIR/hybris-metrics.<pid> when started with HYBRIS_METRICS=1
+ * (see common/metrics.h). Files of processes that are gone are removed.
+ *
+ * Counters are shown with their rate over the last interval, gauges as
+ * they are, and histograms with their sample count, average and the
+ * approximate 50th and 99th percentiles (upper bound of the bucket).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "metrics.h"
+
+#define MAX_PROCESSES 64
+#define METRICS_PREFIX "hybris-metrics."
+
+struct process {
+	pid_t pid;
+	struct hybris_metrics_area *area;
+	/* values at the previous refresh, for counter rates */
+	uint64_t last[HYBRIS_METRICS_MAX];
+	int seen;
+};
+
+static struct process processes[MAX_PROCESSES];
+static int process_count;
+
+static pid_t filter[MAX_PROCESSES];
+static int filter_count;
+
+static const char *metrics_dir(void)
+{
+	const char *dir = getenv("HYBRIS_METRICS_DIR");
+
+	return dir != NULL ? dir : "/dev/shm";
+}
+
+static int wanted(pid_t pid)
+{
+	int i;
+
+	if (filter_count == 0)
+		return 1;
+	for (i = 0; i < filter_count; i++)
+		if (filter[i] == pid)
+			return 1;
+	return 0;
+}
+
+static struct process *find_process(pid_t pid)
+{
+	int i;
+
+	for (i = 0; i < process_count; i++)
+		if (processes[i].pid == pid)
+			return &processes[i];
+	return NULL;
+}
+
+static struct hybris_metrics_area *map_area(const char *path)
+{
+	struct hybris_metrics_area *area;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < (off_t) sizeof(*area)) {
+		close(fd);
+		return NULL;
+	}
+
+	area = mmap(NULL, sizeof(*area), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (area == MAP_FAILED)
+		return NULL;
+
+	if (area->magic != HYBRIS_METRICS_MAGIC || area->version != HYBRIS_METRICS_VERSION) {
+		munmap(area, sizeof(*area));
+		return NULL;
+	}
+
+	return area;
+}
+
+/* Picks up new processes, and drops the ones that went away. */
+static void scan(void)
+{
+	char path[512];
+	struct dirent *entry;
+	DIR *dir;
+	int i;
+
+	for (i = 0; i < process_count; i++) {
+		if (kill(processes[i].pid, 0) != 0 && errno == ESRCH) {
+			munmap(processes[i].area, sizeof(*processes[i].area));
+			processes[i--] = processes[--process_count];
+		}
+	}
+
+	dir = opendir(metrics_dir());
+	if (dir == NULL)
+		return;
+
+	while ((entry = readdir(dir)) != NULL && process_count < MAX_PROCESSES) {
+		struct hybris_metrics_area *area;
+		pid_t pid;
+
+		if (strncmp(entry->d_name, METRICS_PREFIX, strlen(METRICS_PREFIX)) != 0)
+			continue;
+
+		pid = atoi(entry->d_name + strlen(METRICS_PREFIX));
+		if (pid <= 0 || !wanted(pid) || find_process(pid) != NULL)
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", metrics_dir(), entry->d_name);
+
+		/* left behind by a process that crashed */
+		if (kill(pid, 0) != 0 && errno == ESRCH) {
+			unlink(path);
+			continue;
+		}
+
+		area = map_area(path);
+		if (area == NULL)
+			continue;
+
+		memset(&processes[process_count], 0, sizeof(processes[process_count]));
+		processes[process_count].pid = pid;
+		processes[process_count].area = area;
+		process_count++;
+	}
+
+	closedir(dir);
+}
+
+static uint64_t bucket_limit(int bucket)
+{
+	return bucket == 0 ? 0 : (1ULL << bucket) - 1;
+}
+
+static uint64_t percentile(const struct hybris_metric *m, uint64_t count, double p)
+{
+	uint64_t target = (uint64_t) (count * p + 0.5);
+	uint64_t seen = 0;
+	int i;
+
+	if (target == 0)
+		target = 1;
+
+	for (i = 0; i < HYBRIS_METRIC_BUCKETS; i++) {
+		seen += m->buckets[i];
+		if (seen >= target)
+			return bucket_limit(i);
+	}
+
+	return bucket_limit(HYBRIS_METRIC_BUCKETS - 1);
+}
+
+static void show(struct process *p, double interval)
+{
+	struct hybris_metrics_area *area = p->area;
+	uint32_t count = area->count;
+	uint32_t i;
+
+	printf("\n%d %s\n", p->pid, area->comm);
+
+	for (i = 0; i < count && i < HYBRIS_METRICS_MAX; i++) {
+		const struct hybris_metric *m = &area->metrics[i];
+		uint64_t value = m->value;
+
+		switch (m->type) {
+		case HYBRIS_METRIC_COUNTER:
+			if (p->seen)
+				printf("  %-32s %12llu %10.1f/s\n", m->name,
+				       (unsigned long long) value,
+				       (value - p->last[i]) / interval);
+			else
+				printf("  %-32s %12llu\n", m->name, (unsigned long long) value);
+			break;
+		case HYBRIS_METRIC_GAUGE:
+			printf("  %-32s %12lld\n", m->name, (long long) value);
+			break;
+		case HYBRIS_METRIC_HISTOGRAM:
+			if (value == 0) {
+				printf("  %-32s %12s\n", m->name, "-");
+				break;
+			}
+			printf("  %-32s %12llu avg %-8llu p50 <%-8llu p99 <%llu\n", m->name,
+			       (unsigned long long) value,
+			       (unsigned long long) (m->sum / value),
+			       (unsigned long long) percentile(m, value, 0.50) + 1,
+			       (unsigned long long) percentile(m, value, 0.99) + 1);
+			break;
+		}
+
+		p->last[i] = value;
+	}
+
+	p->seen = 1;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: hybris-top [-d seconds] [-n iterations] [pid...]\n"
+		"  -d  refresh interval (default 1)\n"
+		"  -n  number of refreshes, 0 for no limit (default 0)\n");
+}
+
+int main(int argc, char *argv[])
+{
+	double interval = 1.0;
+	int iterations = 0;
+	int n, i, opt;
+
+	while ((opt = getopt(argc, argv, "d:n:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			interval = atof(optarg);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		default:
+			usage();
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (interval <= 0) {
+		usage();
+		return 1;
+	}
+
+	for (; optind < argc && filter_count < MAX_PROCESSES; optind++)
+		filter[filter_count++] = atoi(argv[optind]);
+
+	for (n = 0; iterations == 0 || n < iterations; n++) {
+		struct timespec ts;
+
+		if (n > 0) {
+			ts.tv_sec = (time_t) interval;
+			ts.tv_nsec = (long) ((interval - ts.tv_sec) * 1e9);
+			nanosleep(&ts, NULL);
+		}
+
+		scan();
+
+		if (isatty(STDOUT_FILENO))
+			printf("\033[H\033[2J");
+		printf("hybris-top: %d process%s in %s\n", process_count,
+		       process_count == 1 ? "" : "es", metrics_dir());
+
+		for (i = 0; i < process_count; i++)
+			show(&processes[i], interval);
+
+		fflush(stdout);
+	}
+
+	return 0;
+}
+
+// vim:ts=4:sw=4:noexpandtab
@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) 2013 libhybris
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Throughput and latency of the property backends:
+ *
+ *   socket  property_get() answered by the property service
+ *   cache   property_get() answered by the build.prop cache, as happens
+ *           when there is no property service
+ *   area    property_find() and property_read() on the shared area
+ *
+ * Unless -p is given, a stand-in property service speaking prop_msg_t is
+ * started in-process, so that no Android init is needed. With -S, only that
+ * server is run, e.g. for getprop and setprop.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <hybris/properties/properties.h>
+
+#define SERVER_FILLER_PROPS 256
+#define SERVER_MAX_PROPS 1024
+
+enum backend {
+	BACKEND_SOCKET,
+	BACKEND_CACHE,
+	BACKEND_AREA,
+};
+
+static const char *backend_names[] = { "socket", "cache", "area" };
+
+struct bench_thread {
+	pthread_t thread;
+	unsigned long long *samples;
+};
+
+static enum backend backend = BACKEND_SOCKET;
+static const char *key = "ro.build.version.sdk";
+static int iterations = 10000;
+static int set_mode = 0;
+
+static const prop_info *area_pi;
+
+/* stand-in property service */
+static prop_msg_t server_props[SERVER_MAX_PROPS];
+static int server_count;
+static pthread_mutex_t server_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static prop_msg_t *server_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < server_count; i++) {
+		if (strcmp(server_props[i].name, name) == 0)
+			return &server_props[i];
+	}
+
+	return NULL;
+}
+
+static void server_set(const char *name, const char *value)
+{
+	prop_msg_t *prop;
+
+	pthread_mutex_lock(&server_mutex);
+
+	prop = server_find(name);
+	if (prop == NULL && server_count < SERVER_MAX_PROPS) {
+		prop = &server_props[server_count++];
+		strncpy(prop->name, name, PROP_NAME_MAX - 1);
+	}
+	if (prop)
+		strncpy(prop->value, value, PROP_VALUE_MAX - 1);
+
+	pthread_mutex_unlock(&server_mutex);
+}
+
+/* one request per connection, replies are sent back as prop_msg_t, and the
+ * end of the answer is signalled by closing the socket, like patched init */
+static void server_handle(int s)
+{
+	prop_msg_t msg, *prop;
+	int i;
+
+	if (recv(s, &msg, sizeof(msg), MSG_WAITALL) != sizeof(msg))
+		return;
+
+	msg.name[PROP_NAME_MAX - 1] = '\0';
+	msg.value[PROP_VALUE_MAX - 1] = '\0';
+
+	switch (msg.cmd) {
+	case PROP_MSG_SETPROP:
+		server_set(msg.name, msg.value);
+		break;
+	case PROP_MSG_GETPROP:
+		pthread_mutex_lock(&server_mutex);
+		prop = server_find(msg.name);
+		memset(msg.value, 0, sizeof(msg.value));
+		if (prop)
+			strcpy(msg.value, prop->value);
+		pthread_mutex_unlock(&server_mutex);
+		send(s, &msg, sizeof(msg), MSG_NOSIGNAL);
+		break;
+	case PROP_MSG_LISTPROP:
+		pthread_mutex_lock(&server_mutex);
+		for (i = 0; i < server_count; i++) {
+			if (send(s, &server_props[i], sizeof(msg), MSG_NOSIGNAL) != sizeof(msg))
+				break;
+		}
+		pthread_mutex_unlock(&server_mutex);
+		break;
+	}
+}
+
+static void *server_thread(void *arg)
+{
+	int fd = (int) (long) arg;
+	int s;
+
+	for (;;) {
+		s = accept(fd, NULL, NULL);
+		if (s < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		server_handle(s);
+		close(s);
+	}
+
+	return NULL;
+}
+
+static int server_start(const char *path)
+{
+	struct sockaddr_un addr;
+	char name[PROP_NAME_MAX];
+	int fd, i;
+
+	server_set("ro.build.version.sdk", "17");
+	server_set(key, "1");
+	for (i = 0; i < SERVER_FILLER_PROPS; i++) {
+		snprintf(name, sizeof(name), "bench.prop.%d", i);
+		server_set(name, "value");
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_LOCAL;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "socket path too long: %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	unlink(path);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 128) != 0) {
+		perror("can't listen on the server socket");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void bench_op(char *value)
+{
+	switch (backend) {
+	case BACKEND_SOCKET:
+	case BACKEND_CACHE:
+		if (set_mode)
+			property_set(key, "1");
+		else
+			property_get(key, value, "");
+		break;
+	case BACKEND_AREA:
+		if (set_mode)
+			property_set(key, "1");
+		else
+			property_read(area_pi ? area_pi : property_find(key), NULL, value);
+		break;
+	}
+}
+
+static void *bench_thread(void *arg)
+{
+	struct bench_thread *t = arg;
+	char value[PROP_VALUE_MAX];
+	unsigned long long start;
+	int i;
+
+	for (i = 0; i < iterations; i++) {
+		start = now_ns();
+		bench_op(value);
+		t->samples[i] = now_ns() - start;
+	}
+
+	return NULL;
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+	unsigned long long sa = *(const unsigned long long *) a;
+	unsigned long long sb = *(const unsigned long long *) b;
+
+	return sa < sb ? -1 : sa > sb;
+}
+
+static void report(unsigned long long *samples, size_t count, double elapsed)
+{
+	static const double percentiles[] = { 50, 90, 99, 99.9 };
+	unsigned int i;
+
+	qsort(samples, count, sizeof(samples[0]), compare_samples);
+
+	printf("%s %s: %zu ops in %.3f s, %.0f ops/s\n", backend_names[backend],
+			set_mode ? "property_set" : backend == BACKEND_AREA ? "property_read" : "property_get",
+			count, elapsed, count / elapsed);
+	for (i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+		size_t index = count * percentiles[i] / 100;
+
+		if (index >= count)
+			index = count - 1;
+		printf("  p%-5g %10.3f us\n", percentiles[i], samples[index] / 1e3);
+	}
+	printf("  max    %10.3f us\n", samples[count - 1] / 1e3);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: hybris-propbench [-b socket|cache|area] [-t threads] [-n iterations]\n"
+		"                        [-k key] [-s] [-p socket | -S socket]\n"
+		"  -s         benchmark property_set() instead of lookups\n"
+		"  -p socket  use an existing property service instead of the stand-in\n"
+		"  -S socket  only run the stand-in property service\n");
+}
+
+int main(int argc, char *argv[])
+{
+	char server_path[64], area_path[64];
+	const char *socket_path = NULL;
+	struct bench_thread *threads;
+	unsigned long long *samples;
+	unsigned long long start;
+	int nthreads = 1;
+	int serve_only = 0;
+	int server_fd = -1;
+	pthread_t server;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "b:t:n:k:sp:S:h")) != -1) {
+		switch (opt) {
+		case 'b':
+			for (i = 0; i < 3 && strcmp(optarg, backend_names[i]); i++)
+				;
+			if (i == 3) {
+				usage();
+				return 1;
+			}
+			backend = i;
+			break;
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'k':
+			key = optarg;
+			break;
+		case 's':
+			set_mode = 1;
+			break;
+		case 'p':
+			socket_path = optarg;
+			break;
+		case 'S':
+			socket_path = optarg;
+			serve_only = 1;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (nthreads <= 0 || iterations <= 0 || strlen(key) >= PROP_NAME_MAX - 1) {
+		usage();
+		return 1;
+	}
+
+	if (serve_only) {
+		server_fd = server_start(socket_path);
+		if (server_fd < 0)
+			return 1;
+		printf("serving properties on %s\n", socket_path);
+		server_thread((void *) (long) server_fd);
+		return 1;
+	}
+
+	if (socket_path == NULL) {
+		snprintf(server_path, sizeof(server_path), "/tmp/hybris-propbench.%d", getpid());
+		server_fd = server_start(server_path);
+		if (server_fd < 0)
+			return 1;
+		if (pthread_create(&server, NULL, server_thread, (void *) (long) server_fd) != 0)
+			return 1;
+		socket_path = server_path;
+
+		/* don't let the stand-in values leak into the real area */
+		snprintf(area_path, sizeof(area_path), "/tmp/hybris-propbench-area.%d", getpid());
+		setenv("HYBRIS_PROPERTY_AREA", area_path, 0);
+	}
+
+	/* measure the backends themselves, not the per-process cache */
+	setenv("HYBRIS_PROPERTY_CACHE_TTL", "0", 1);
+	setenv("HYBRIS_PROPERTY_CACHE_RO", "0", 1);
+	setenv("HYBRIS_PROPERTY_SOCKET",
+			backend == BACKEND_CACHE && !set_mode ? "/nonexistent" : socket_path, 1);
+
+	if (backend == BACKEND_AREA && !set_mode) {
+		area_pi = property_find(key);
+		if (area_pi == NULL)
+			fprintf(stderr, "warning: %s not in the property area\n", key);
+	}
+
+	threads = calloc(nthreads, sizeof(*threads));
+	samples = malloc(sizeof(*samples) * nthreads * iterations);
+	if (!threads || !samples) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	start = now_ns();
+	for (i = 0; i < nthreads; i++) {
+		threads[i].samples = samples + (size_t) i * iterations;
+		if (pthread_create(&threads[i].thread, NULL, bench_thread, &threads[i]) != 0) {
+			fprintf(stderr, "can't create thread %d\n", i);
+			return 1;
+		}
+	}
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i].thread, NULL);
+
+	report(samples, (size_t) nthreads * iterations, (now_ns() - start) / 1e9);
+
+	if (server_fd >= 0) {
+		unlink(server_path);
+		unlink(area_path);
+	}
+
+	free(samples);
+	free(threads);
+	return 0;
+}
+
+// vim:ts=4:sw=4:noexpandtab